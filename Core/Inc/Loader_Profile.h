@@ -0,0 +1,94 @@
+/**
+  ******************************************************************************
+  * @file    Loader_Profile.h
+  * @brief   Cycle counts of the loader entry points and of the W25Qx driver
+  *          phases, taken with the DWT cycle counter. Calls, min, max and
+  *          total cycles of each point are kept in LoaderProfile, placed in
+  *          the .loader_profile section of linker.ld so it can be read over
+  *          SWD after a programming session. Nothing is compiled when
+  *          LOADER_PROFILE is 0.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __LOADER_PROFILE_H
+#define __LOADER_PROFILE_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f3xx.h"
+
+#ifndef LOADER_PROFILE
+#define LOADER_PROFILE 0
+#endif
+
+/* LoaderProfile.Magic once the block is valid */
+#define LOADER_PROFILE_MAGIC 0x50524F46
+
+/* Profiled points. Entry point times include the driver phases they run */
+typedef enum
+{
+  LOADER_PROFILE_INIT = 0,
+  LOADER_PROFILE_READ,
+  LOADER_PROFILE_WRITE,
+  LOADER_PROFILE_MASS_ERASE,
+  LOADER_PROFILE_SECTOR_ERASE,
+  LOADER_PROFILE_CHECKSUM,
+  LOADER_PROFILE_VERIFY,
+  LOADER_PROFILE_CRC32,
+  LOADER_PROFILE_W25QX_COMMAND, /* write enable, command and address bytes */
+  LOADER_PROFILE_W25QX_DATA,    /* data phase, waiting for the DMA */
+  LOADER_PROFILE_W25QX_BUSY,    /* status polling until BUSY clears */
+  LOADER_PROFILE_COUNT
+} Loader_ProfilePointTypeDef;
+
+typedef struct
+{
+  uint32_t Calls;
+  uint32_t Min;                 /* cycles */
+  uint32_t Max;
+  uint64_t Total;
+} Loader_ProfileEntryTypeDef;
+
+typedef struct
+{
+  uint32_t Magic;               /* LOADER_PROFILE_MAGIC */
+  uint32_t Count;               /* LOADER_PROFILE_COUNT */
+  Loader_ProfileEntryTypeDef Entry[LOADER_PROFILE_COUNT];
+} Loader_ProfileTypeDef;
+
+#if LOADER_PROFILE
+
+typedef struct
+{
+  uint32_t Point;
+  uint32_t Start;
+} Loader_ProfileScopeTypeDef;
+
+extern volatile Loader_ProfileTypeDef LoaderProfile;
+
+void Loader_ProfileStart(void);
+void Loader_ProfileAdd(uint32_t Point, uint32_t Cycles);
+void Loader_ProfileLeave(Loader_ProfileScopeTypeDef* Scope);
+
+/* Starts the cycle counter, from Init */
+#define LOADER_PROFILE_START()       Loader_ProfileStart()
+
+/* Times the rest of the enclosing block, whatever return leaves it */
+#define LOADER_PROFILE_SCOPE(Point) \
+  Loader_ProfileScopeTypeDef LoaderProfileScope __attribute__((cleanup(Loader_ProfileLeave))) = { (Point), DWT->CYCCNT }
+
+/* Times the code between the two, on the paths reaching LOADER_PROFILE_END */
+#define LOADER_PROFILE_BEGIN(Stamp)  uint32_t Stamp = DWT->CYCCNT
+#define LOADER_PROFILE_END(Point, Stamp) \
+  Loader_ProfileAdd((Point), DWT->CYCCNT - (Stamp))
+
+#else
+
+#define LOADER_PROFILE_START()           ((void)0)
+#define LOADER_PROFILE_SCOPE(Point)      ((void)0)
+#define LOADER_PROFILE_BEGIN(Stamp)      ((void)0)
+#define LOADER_PROFILE_END(Point, Stamp) ((void)0)
+
+#endif /* LOADER_PROFILE */
+
+#endif /* __LOADER_PROFILE_H */
@@ -31,6 +31,91 @@
 #define LOADER_OK 0x1
 #define LOADER_FAIL 0x0
 
+/* RAM buffer used to stream flash content through the CPU (blank checks...),
+   split in two halves for the ping-pong reads of CheckSum, Verify and Crc32 */
+#ifndef LOADER_SCRATCH_SIZE
+#define LOADER_SCRATCH_SIZE 512
+#endif
+
+/* Add up the checksum bytes four at a time with the Cortex-M4 USADA8
+   instruction, a byte loop is used on cores without the DSP extension */
+#ifndef LOADER_SIMD_CHECKSUM
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#define LOADER_SIMD_CHECKSUM 1
+#else
+#define LOADER_SIMD_CHECKSUM 0
+#endif
+#endif
+
+/* Crc32 entry point: CRC-32 (IEEE 802.3, as computed by zlib) of a flash
+   range, so a region is checked against a CRC computed by the host with a
+   single 32-bit result instead of a read back and compare */
+#ifndef LOADER_CRC32
+#define LOADER_CRC32 0
+#endif
+
+/* Compute the CRC-32 with the CRC unit, or with a nibble table when 0 */
+#ifndef LOADER_CRC32_HARDWARE
+#define LOADER_CRC32_HARDWARE 1
+#endif
+
+/* Incremental update: Write compares each range with the flash first. A
+   range that only clears bits is programmed in place, one that needs bits
+   back to 1 goes through the erase of its sector, the content around the
+   range being programmed back from a sector sized RAM buffer. SectorErase
+   and MassErase still erase, the host skips its own erase to benefit */
+#ifndef LOADER_INCREMENTAL_UPDATE
+#define LOADER_INCREMENTAL_UPDATE 0
+#endif
+
+/* Differential reflash: on top of the incremental update, a range the
+   flash already holds is neither erased nor programmed */
+#ifndef LOADER_DIFFERENTIAL_REFLASH
+#define LOADER_DIFFERENTIAL_REFLASH 0
+#endif
+
+/* Erase-ahead: SectorErase issues its erases without waiting for them, the
+   driver waits before the next command, so the last erase of a range runs
+   while the host transfers the data to program. Sectors erased in the
+   session are tracked and never erased again before they get programmed */
+#ifndef LOADER_ERASE_AHEAD
+#define LOADER_ERASE_AHEAD 0
+#endif
+
+/* Both modes compare the data with the flash before erasing */
+#define LOADER_IN_PLACE_UPDATE (LOADER_INCREMENTAL_UPDATE || LOADER_DIFFERENTIAL_REFLASH)
+
+/* Auto-erase: Write erases each sector the first time it lands in it in
+   the session, so the host does not need to erase first. Content of a
+   partially written sector outside the range is read into a sector sized
+   RAM buffer and programmed back. Sectors erased by SectorErase or
+   MassErase count as erased for the session. A write over data the
+   session already programmed goes through the erase again */
+#ifndef LOADER_AUTO_ERASE
+#define LOADER_AUTO_ERASE 0
+#endif
+
+#if LOADER_AUTO_ERASE && LOADER_IN_PLACE_UPDATE
+#error "LOADER_AUTO_ERASE erases every sector it writes, it cannot be combined with the in place update modes"
+#endif
+
+/* Write erases on its own the sectors it cannot program as they are */
+#define LOADER_WRITE_ERASE (LOADER_AUTO_ERASE || LOADER_IN_PLACE_UPDATE)
+
+/* Session statistics, read back over SWD after a programming session */
+typedef struct
+{
+  uint32_t BlankSectors;        /* sectors found erased, erase skipped */
+  uint32_t BlankPages;          /* pages of erase value data, program skipped */
+  uint32_t UnchangedSectors;    /* sectors already holding the data, left untouched */
+  uint32_t BitClearedSectors;   /* sectors reprogrammed without erase */
+  uint32_t RewrittenSectors;    /* sectors erased and reprogrammed */
+  uint32_t AheadErases;         /* erases issued without waiting for them */
+  uint32_t AutoErasedSectors;   /* sectors erased by Write in auto-erase mode */
+} Loader_StatsTypeDef;
+
+extern volatile Loader_StatsTypeDef LoaderStats;
+
 /* Private function prototypes -----------------------------------------------*/
 KeepInCompilation int Init ();
 KeepInCompilation int Read (uint32_t Address, uint32_t Size, uint8_t* Buffer);
@@ -38,5 +123,8 @@ KeepInCompilation int Write (uint32_t Address, uint32_t Size, uint8_t* Buffer);
 KeepInCompilation int MassErase (void);
 KeepInCompilation int SectorErase (uint32_t EraseStartAddress ,uint32_t EraseEndAddress);
 KeepInCompilation uint64_t Verify (uint32_t MemoryAddr, uint32_t RAMBufferAddr, uint32_t Size, uint32_t missalignement);
+#if LOADER_CRC32
+KeepInCompilation uint32_t Crc32 (uint32_t StartAddress, uint32_t Size, uint32_t InitVal);
+#endif
 
 #endif /* __LOADER_SRC_H */
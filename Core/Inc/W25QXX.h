@@ -48,19 +48,90 @@
   */  
 #define MEMORY_FLASH_SIZE                  (0x800000 / 8)  /* 8 MBits => 1024KB */
 #define MEMORY_BLOCK_SIZE                  0x10000   /* 64KBytes */
+#define MEMORY_BLOCK32_SIZE                0x8000    /* 32KBytes */
 #define MEMORY_SECTOR_SIZE                 0x1000    /* 4kBytes */
 #define MEMORY_PAGE_SIZE                   0x100     /* 256 bytes */
+#define MEMORY_ERASE_VALUE                 0xFF      /* content of erased memory */
 
 #define W25Q80_PAGE_SIZE  MEMORY_PAGE_SIZE
 
 #define W25Q80_DUMMY_CYCLES_READ           4
 #define W25Q80_DUMMY_CYCLES_READ_QUAD      10
+#define W25Q80_DUMMY_BYTES_FAST_READ       1     /* 8 dummy clocks on single SPI */
 
 #define W25Q80_BULK_ERASE_MAX_TIME         250000
 #define W25Q80_SECTOR_ERASE_MAX_TIME       3000
 #define W25Q80_SUBSECTOR_ERASE_MAX_TIME    800
+#define W25Q80_BLOCK32_ERASE_MAX_TIME      1600
+#define W25Q80_BLOCK64_ERASE_MAX_TIME      2000
 #define W25Qx_TIMEOUT_VALUE 1000
 
+/* Read command used by BSP_W25Qx_Read : FAST_READ_CMD or READ_CMD */
+#ifndef W25Qx_READ_CMD
+#define W25Qx_READ_CMD                     FAST_READ_CMD
+#endif
+
+/* SPI3 clock (APB1 36MHz / prescaler), reads run at the fastest setting */
+#ifndef W25Qx_READ_PRESCALER
+#define W25Qx_READ_PRESCALER               SPI_BAUDRATEPRESCALER_2   /* 18MHz */
+#endif
+#ifndef W25Qx_DEFAULT_PRESCALER
+#define W25Qx_DEFAULT_PRESCALER            SPI_BAUDRATEPRESCALER_4   /* 9MHz, as set by MX_SPI3_Init */
+#endif
+
+/* Run the command, status and ID transactions and the chip select on the
+   register layer of W25Qx_SPI.h instead of the blocking HAL calls.
+   W25Qx_Enable/W25Qx_Disable then need W25Qx_SPI.h, included by W25QXX.c */
+#ifndef W25Qx_DIRECT_SPI
+#define W25Qx_DIRECT_SPI                   1
+#endif
+
+/* Read WEL back after each write enable */
+#ifndef W25Qx_CHECK_WEL
+#define W25Qx_CHECK_WEL                    0
+#endif
+
+/* Return from BSP_W25Qx_Write without waiting for the last page program,
+   the next command waits for it instead. The program then overlaps the
+   SWD transfer of the next call: the host bench at 300 KB/s gains 0.5%
+   on a full 1MB image written in 8KB calls, 14% on short writes */
+#ifndef W25Qx_WRITE_BEHIND
+#define W25Qx_WRITE_BEHIND                 0
+#endif
+
+/* Return from the sector/block erase functions once the command is issued.
+   A range of erases then only waits between sectors and the last one
+   completes while the host stages the next data. The chip erase always
+   waits, it is longer than the host allows for the following command.
+   The host bench at 300 KB/s gains 15% when each sector is erased just
+   before it is written, 0.2% on a whole chip range erased at once */
+#ifndef W25Qx_ERASE_BEHIND
+#define W25Qx_ERASE_BEHIND                 0
+#endif
+
+/* Largest single DMA transfer, the DMA counter is 16-bit */
+#define W25Qx_DMA_CHUNK_SIZE               0x8000
+
+/* Record every chip select cycle (opcode, address, data length, DWT cycle
+   stamps, result) in the W25Qx_Trace ring buffer, to be dumped over SWD
+   and decoded by w25qx_trace of Host/. It stays on in production: the
+   buffer takes 16 bytes plus 16 bytes per record, 272 bytes of the 16KB
+   RAM window with the default depth of 16, and the two hooks add a few
+   tens of instructions per chip select cycle, under 1us at 72MHz against
+   115us to send a full page at 18MHz. The status polls of a busy wait
+   share one record. W25Qx_TRACE_DEPTH is a power of 2, raise it to keep
+   a longer history */
+#ifndef W25Qx_TRACE
+#define W25Qx_TRACE                        1
+#endif
+#ifndef W25Qx_TRACE_DEPTH
+#define W25Qx_TRACE_DEPTH                  16
+#endif
+
+#if W25Qx_TRACE && (W25Qx_TRACE_DEPTH & (W25Qx_TRACE_DEPTH - 1)) != 0
+#error "W25Qx_TRACE_DEPTH must be a power of 2"
+#endif
+
 /** 
   * @brief  W25Q80 Commands  
   */  
@@ -106,6 +177,8 @@
 
 /* Erase Operations */
 #define SECTOR_ERASE_CMD                     0x20
+#define BLOCK32_ERASE_CMD                    0x52
+#define BLOCK64_ERASE_CMD                    0xD8
 #define CHIP_ERASE_CMD                       0xC7
 
 #define PROG_ERASE_RESUME_CMD                0x7A
@@ -118,22 +191,60 @@
 #define W25Q80_FSR_QE                      ((uint8_t)0x02)    /*!< quad enable */
 
 
+#if W25Qx_DIRECT_SPI
+#define W25Qx_Enable() 			W25Qx_SPI_Select()
+#define W25Qx_Disable() 		W25Qx_SPI_Deselect()
+#else
 #define W25Qx_Enable() 			HAL_GPIO_WritePin(GPIOD, GPIO_PIN_2, GPIO_PIN_RESET)
 #define W25Qx_Disable() 		HAL_GPIO_WritePin(GPIOD, GPIO_PIN_2, GPIO_PIN_SET)
+#endif
 
 #define W25Qx_OK            ((uint8_t)0x00)
 #define W25Qx_ERROR         ((uint8_t)0x01)
 #define W25Qx_BUSY          ((uint8_t)0x02)
 #define W25Qx_TIMEOUT				((uint8_t)0x03)
 
+/* Trace of the chip select cycles, the layout read by w25qx_trace */
+#define W25Qx_TRACE_MAGIC   0x54353257   /* "W25T" */
+
+typedef struct
+{
+	uint32_t Start;      /* DWT->CYCCNT when the chip is selected */
+	uint32_t End;        /* DWT->CYCCNT when it is deselected */
+	uint32_t Command;    /* opcode in bits 31:24, address in bits 23:0 */
+	uint32_t Length;     /* result in bits 31:24, data bytes in bits 23:0 */
+} W25Qx_TraceRecordTypeDef;
+
+typedef struct
+{
+	uint32_t Magic;      /* W25Qx_TRACE_MAGIC */
+	uint32_t Depth;      /* W25Qx_TRACE_DEPTH */
+	uint32_t Clock;      /* DWT cycles per second */
+	uint32_t Count;      /* records written, the next goes to Count % Depth */
+	W25Qx_TraceRecordTypeDef Record[W25Qx_TRACE_DEPTH];
+} W25Qx_TraceTypeDef;
+
+#if W25Qx_TRACE
+extern W25Qx_TraceTypeDef W25Qx_Trace;
+#endif
+
 
 uint8_t BSP_W25Qx_Init(void);
 uint8_t BSP_W25Qx_WriteEnable(void);
-void BSP_W25Qx_Read_ID(uint8_t *ID);
+uint8_t BSP_W25Qx_WaitPending(void);
+uint8_t BSP_W25Qx_Read_ID(uint8_t *ID);
 uint8_t BSP_W25Qx_Read(uint8_t* pData, uint32_t ReadAddr, uint32_t Size);
+uint8_t BSP_W25Qx_Stream_Start(uint32_t ReadAddr, uint32_t Size, uint8_t* pBuffer, uint16_t HalfSize);
+uint8_t BSP_W25Qx_Stream_Next(uint8_t** pData, uint32_t* Size);
+void BSP_W25Qx_Stream_Stop(void);
 uint8_t BSP_W25Qx_Write(uint8_t* pData, uint32_t WriteAddr, uint32_t Size);
 uint8_t BSP_W25Qx_Erase_Block(uint32_t Address);
+uint8_t BSP_W25Qx_Erase_Block32K(uint32_t Address);
+uint8_t BSP_W25Qx_Erase_Block64K(uint32_t Address);
 uint8_t BSP_W25Qx_Erase_Chip(void);
+uint8_t BSP_W25Qx_Start_Erase_Block(uint32_t Address);
+uint8_t BSP_W25Qx_Start_Erase_Block32K(uint32_t Address);
+uint8_t BSP_W25Qx_Start_Erase_Block64K(uint32_t Address);
 
 /**
   * @}
@@ -0,0 +1,133 @@
+/**
+  ******************************************************************************
+  * @file    W25Qx_SPI.h
+  * @brief   Register level SPI3 transfers for the short transactions of
+  *          W25QXX.c (commands, status polls, ID, read headers). Each one
+  *          is a single full duplex transfer. Bytes go through DR with
+  *          the RX FIFO threshold at 8 bits, set once by W25Qx_SPI_Setup,
+  *          and the PD2 chip select is driven through BSRR. There is no
+  *          lock, state or tick bookkeeping: a transfer only fails when
+  *          SPI3 stops moving bytes, after W25Qx_SPI_POLL_LIMIT polls.
+  *          MX_SPI3_Init still configures the peripheral and the DMA
+  *          transfers stay on the HAL.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __W25QX_SPI_H
+#define __W25QX_SPI_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f3xx.h"
+#include "spi.h"
+#include "W25QXX.h"
+
+/* Polls of SR without a byte sent or received before a transfer is given
+   up, about 1ms at 72MHz: more than a byte at the slowest SPI3 clock */
+#ifndef W25Qx_SPI_POLL_LIMIT
+#define W25Qx_SPI_POLL_LIMIT               10000
+#endif
+
+/* Register accesses, the host build maps them onto its SPI3 model */
+#ifndef W25Qx_SPI_READ_SR
+#define W25Qx_SPI_READ_SR(SPIx)            ((SPIx)->SR)
+#define W25Qx_SPI_READ_DR(SPIx)            (*(__IO uint8_t *)&(SPIx)->DR)
+#define W25Qx_SPI_WRITE_DR(SPIx, Data)     (*(__IO uint8_t *)&(SPIx)->DR = (Data))
+#define W25Qx_SPI_WRITE_BSRR(GPIOx, Value) ((GPIOx)->BSRR = (Value))
+#endif
+
+/**
+  * @brief  Sets the RXNE event at 8 bits, for byte accesses to DR.
+  *         HAL DMA transfers keep it, blocking HAL transfers must not be
+  *         mixed with this layer.
+  * @param  SPIx: SPI instance
+  * @retval None
+  */
+static inline void W25Qx_SPI_Setup(SPI_TypeDef *SPIx)
+{
+	SET_BIT(SPIx->CR2, SPI_CR2_FRXTH);
+}
+
+/**
+  * @brief  Chip select low.
+  * @retval None
+  */
+static inline void W25Qx_SPI_Select(void)
+{
+	W25Qx_SPI_WRITE_BSRR(GPIOD, (uint32_t)GPIO_PIN_2 << 16);
+}
+
+/**
+  * @brief  Chip select high. Only called once the last byte is received,
+  *         the bus is idle.
+  * @retval None
+  */
+static inline void W25Qx_SPI_Deselect(void)
+{
+	W25Qx_SPI_WRITE_BSRR(GPIOD, GPIO_PIN_2);
+}
+
+/**
+  * @brief  Runs a command and its response as one full duplex transfer:
+  *         the CmdSize bytes of pCmd go out, then 0xFF while the Size
+  *         bytes of the response are clocked in. The next byte is written
+  *         while the previous one shifts, so the bus clocks without a gap
+  *         between bytes or between the two phases. SPE is set again when
+  *         BSP_W25Qx_SetClock cleared it. The transfer stops when no byte
+  *         moves for W25Qx_SPI_POLL_LIMIT polls, the chip select is left
+  *         to the caller.
+  * @param  SPIx: SPI instance
+  * @param  pCmd: Bytes sent first, may be NULL when CmdSize is 0
+  * @param  CmdSize: Number of bytes sent
+  * @param  pData: Bytes received after the command, may be NULL when Size is 0
+  * @param  Size: Number of bytes received
+  * @retval W25Qx_OK or W25Qx_TIMEOUT
+  */
+static inline uint8_t W25Qx_SPI_Transaction(SPI_TypeDef *SPIx, const uint8_t *pCmd, uint16_t CmdSize, uint8_t *pData, uint16_t Size)
+{
+	uint32_t total = (uint32_t)CmdSize + Size;
+	uint32_t tx = 0, rx = 0, polls = 0;
+	uint8_t data;
+
+	if ((SPIx->CR1 & SPI_CR1_SPE) == 0)
+	{
+		SET_BIT(SPIx->CR1, SPI_CR1_SPE);
+	}
+
+	while (rx < total)
+	{
+		/* At most 2 bytes in flight, the RX FIFO cannot overrun */
+		if (tx < total && tx - rx < 2 && (W25Qx_SPI_READ_SR(SPIx) & SPI_SR_TXE) != 0)
+		{
+			W25Qx_SPI_WRITE_DR(SPIx, (tx < CmdSize) ? pCmd[tx] : 0xFF);
+			tx++;
+			polls = 0;
+		}
+		if ((W25Qx_SPI_READ_SR(SPIx) & SPI_SR_RXNE) != 0)
+		{
+			data = W25Qx_SPI_READ_DR(SPIx);
+			if (rx >= CmdSize)
+			{
+				pData[rx - CmdSize] = data;
+			}
+			rx++;
+			polls = 0;
+		}
+		else if (++polls > W25Qx_SPI_POLL_LIMIT)
+		{
+			return W25Qx_TIMEOUT;
+		}
+	}
+	
+	return W25Qx_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __W25QX_SPI_H */
@@ -17,7 +17,7 @@ struct StorageInfo const StorageInfo = {
     0x00000000,                         // Device Start Address
     MEMORY_FLASH_SIZE,                  // Device Size in Bytes
     MEMORY_PAGE_SIZE,                   // Programming Page Size
-    0xFF,                               // Initial Content of Erased Memory
+    MEMORY_ERASE_VALUE,                 // Initial Content of Erased Memory
 
     // Specify Size and Address of Sectors (view example below)
     { { (MEMORY_FLASH_SIZE / MEMORY_SECTOR_SIZE),  // Sector Numbers,
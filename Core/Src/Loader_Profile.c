@@ -0,0 +1,70 @@
+/**
+  ******************************************************************************
+  * @file    Loader_Profile.c
+  * @brief   DWT cycle counter statistics of Loader_Profile.h
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "Loader_Profile.h"
+
+#if LOADER_PROFILE
+
+/* Read over SWD from the .loader_profile section */
+__attribute__((used, section(".loader_profile")))
+volatile Loader_ProfileTypeDef LoaderProfile =
+{
+  LOADER_PROFILE_MAGIC,
+  LOADER_PROFILE_COUNT,
+};
+
+/**
+  * Description :
+  * Enable the DWT cycle counter. The statistics are kept from one Init to
+  * the next, the block is zeroed when the loader is loaded.
+  * Inputs    :
+  *      None
+  * outputs   :
+  *      None
+  */
+void Loader_ProfileStart(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+  * Description :
+  * Account a measurement to a profiled point
+  * Inputs    :
+  *      Point         : Loader_ProfilePointTypeDef value
+  *      Cycles        : Cycles elapsed
+  * outputs   :
+  *      None
+  */
+void Loader_ProfileAdd(uint32_t Point, uint32_t Cycles)
+{
+  volatile Loader_ProfileEntryTypeDef* entry = &LoaderProfile.Entry[Point];
+
+  if (entry->Calls == 0 || Cycles < entry->Min)
+    entry->Min = Cycles;
+  if (Cycles > entry->Max)
+    entry->Max = Cycles;
+  entry->Total += Cycles;
+  entry->Calls++;
+}
+
+/**
+  * Description :
+  * Cleanup function of LOADER_PROFILE_SCOPE, called when the scope is left
+  * Inputs    :
+  *      Scope         : Point and start stamp
+  * outputs   :
+  *      None
+  */
+void Loader_ProfileLeave(Loader_ProfileScopeTypeDef* Scope)
+{
+  Loader_ProfileAdd(Scope->Point, DWT->CYCCNT - Scope->Start);
+}
+
+#endif /* LOADER_PROFILE */
@@ -2,15 +2,98 @@
 #include "spi.h"
 #include "main.h"
 #include "gpio.h"
+#include "dma.h"
 #include "W25QXX.h"
+#include "Loader_Profile.h"
+#include <string.h>
 
 // select spi flash type to make .stdlr will be failure, so choice the nor flash type to make.
 // in nor flash type must be in memory map mode, the started address is 0x90000000
 // so have to minus this value as the spi started address
 #define START_BIAS_ADDRESS 0x90000000
 
+/* Erase value replicated over a 32-bit word */
+#define LOADER_ERASED_WORD ((uint32_t)MEMORY_ERASE_VALUE * 0x01010101U)
+
+#define LOADER_SECTOR_COUNT (MEMORY_FLASH_SIZE / MEMORY_SECTOR_SIZE)
+
+/* Flash content compared with the data about to be programmed */
+#define LOADER_CMP_SAME       0   /* identical */
+#define LOADER_CMP_SUBSET     1   /* the data only clears bits */
+#define LOADER_CMP_DIFFERENT  2   /* some bits must go back to 1 */
+#define LOADER_CMP_NONE       0xFF   /* nothing compared yet */
+
+/* Sector bitmap helpers */
+#define LOADER_SECTOR_TEST(map, sector)   ((map)[(sector) / 32] & (1UL << ((sector) % 32)))
+#define LOADER_SECTOR_SET(map, sector)    ((map)[(sector) / 32] |= (1UL << ((sector) % 32)))
+#define LOADER_SECTOR_CLEAR(map, sector)  ((map)[(sector) / 32] &= ~(1UL << ((sector) % 32)))
+
+#if LOADER_CRC32 && !LOADER_CRC32_HARDWARE
+/* CRC-32 of the 16 values of a nibble, reflected polynomial 0xEDB88320 */
+static const uint32_t LoaderCrc32Table[16] =
+{
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+  0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+  0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+#endif
+
 extern void SystemClock_Config(void);
 
+KeepInCompilation volatile Loader_StatsTypeDef LoaderStats;
+
+static uint32_t LoaderScratch[LOADER_SCRATCH_SIZE / 4];
+
+/* Erased sectors are tracked over the session */
+#define LOADER_SESSION_ERASE (LOADER_WRITE_ERASE || LOADER_ERASE_AHEAD)
+
+#if LOADER_SESSION_ERASE
+/* Sectors erased in the session, Write programs them as they are */
+static uint32_t LoaderSessionErased[LOADER_SECTOR_COUNT / 32];
+/* Offset in each session erased sector from which it is still blank,
+   everything the session programmed lies below it */
+static uint16_t LoaderBlankFrom[LOADER_SECTOR_COUNT];
+/* Erased in the session and not programmed since */
+#define LOADER_SESSION_BLANK(sector) \
+  (LOADER_SECTOR_TEST(LoaderSessionErased, sector) && LoaderBlankFrom[sector] == 0)
+#endif
+
+#if LOADER_WRITE_ERASE
+/* Image of a partially written sector while it is erased */
+static uint32_t LoaderSectorImage[MEMORY_SECTOR_SIZE / 4];
+#endif
+
+#if LOADER_IN_PLACE_UPDATE
+/* Worst comparison result of the ranges written into each sector in the
+   session, the sector statistics follow it */
+static uint8_t LoaderVerdict[LOADER_SECTOR_COUNT];
+#endif
+
+static int Loader_Program(uint32_t Address, uint32_t Size, uint8_t* Buffer);
+static uint8_t Loader_EraseSectors(uint32_t Address, uint32_t EndAddress);
+static uint8_t Loader_EraseRange(uint32_t Address, uint32_t EndAddress);
+static uint32_t Loader_EraseSize(uint32_t Address, uint32_t EndAddress);
+static uint8_t Loader_Erase(uint32_t Address, uint32_t Size);
+static int Loader_IsBlank(uint32_t Address, uint32_t Size);
+static int Loader_IsErasedData(const uint8_t* Data, uint32_t Size);
+static void Loader_CheckSumRange(uint32_t StartAddress, uint32_t Size, uint32_t* Begin, uint32_t* End);
+static uint32_t Loader_SumRange(uint32_t Address, uint32_t Size, uint32_t Sum);
+static uint32_t Loader_FindMismatch(const uint8_t* Flash, const uint8_t* Data, uint32_t Size);
+#if LOADER_CRC32
+static uint32_t Loader_Crc32Bytes(const uint8_t* Data, uint32_t Size, uint32_t Crc);
+#endif
+static uint32_t Loader_SumBytes(const uint8_t* Data, uint32_t Size, uint32_t Sum);
+#if LOADER_IN_PLACE_UPDATE
+static int Loader_Rewrite(uint32_t Address, uint32_t EndAddress, uint8_t* Buffer);
+static void Loader_Resolve(uint32_t Sector, int Result);
+static volatile uint32_t* Loader_VerdictStat(int Verdict);
+static int Loader_Compare(uint32_t Address, uint32_t Size, const uint8_t* Buffer);
+#endif
+#if LOADER_WRITE_ERASE
+static int Loader_AutoErase(uint32_t Address, uint32_t Size, uint8_t* Buffer);
+#endif
+
 /**
  * @brief  System initialization.
  * @param  None
@@ -19,7 +102,9 @@ extern void SystemClock_Config(void);
  */
 KeepInCompilation int Init(void) 
 {
-  *(uint32_t*)0xE000EDF0 = 0xA05F0000; //enable interrupts in debug
+  CoreDebug->DHCSR = 0xA05F0000; //enable interrupts in debug
+  LOADER_PROFILE_START();
+  LOADER_PROFILE_SCOPE(LOADER_PROFILE_INIT);
     
   SystemInit();
 
@@ -41,15 +126,36 @@ KeepInCompilation int Init(void)
   SystemClock_Config();
   
   MX_GPIO_Init();
+  MX_DMA_Init();
   __HAL_RCC_SPI3_FORCE_RESET(); 
   __HAL_RCC_SPI3_RELEASE_RESET();
   MX_SPI3_Init();
   
+  /* The previous entry point left the interrupts masked, the DMA and the
+     tick timeouts of the driver need them */
+  __set_PRIMASK(0);
   if(BSP_W25Qx_Init() != W25Qx_OK)
   {
     return LOADER_FAIL;
   }
   
+#if LOADER_CRC32 && LOADER_CRC32_HARDWARE
+  /* Default 0x04C11DB7 polynomial on 32 bits, input bits reversed by byte
+     and output reversed: the reflected CRC-32 of a byte stream */
+  __HAL_RCC_CRC_CLK_ENABLE();
+  CRC->POL = 0x04C11DB7;
+  CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT;
+#endif
+  
+#if LOADER_SESSION_ERASE
+  /* A new session, nothing is known about the content */
+  memset(LoaderSessionErased, 0, sizeof(LoaderSessionErased));
+  memset(LoaderBlankFrom, 0, sizeof(LoaderBlankFrom));
+#endif
+#if LOADER_IN_PLACE_UPDATE
+  memset(LoaderVerdict, LOADER_CMP_NONE, sizeof(LoaderVerdict));
+#endif
+  
   __set_PRIMASK(1); 
   return LOADER_OK;
 }
@@ -69,6 +175,8 @@ KeepInCompilation int Init(void)
   */
 KeepInCompilation int Read (uint32_t Address, uint32_t Size, uint8_t* buffer)
 { 
+  LOADER_PROFILE_SCOPE(LOADER_PROFILE_READ);
+  
   __set_PRIMASK(0);
   if(BSP_W25Qx_Read(buffer, (Address & 0x0fffffff), Size) != W25Qx_OK)
   {
@@ -94,15 +202,123 @@ KeepInCompilation int Read (uint32_t Address, uint32_t Size, uint8_t* buffer)
   */
 KeepInCompilation int Write (uint32_t Address, uint32_t Size, uint8_t* buffer)
 {
+#if LOADER_IN_PLACE_UPDATE
+  uint32_t address, end_address, size, sector, offset, run_start;
+  int result;
+#elif LOADER_AUTO_ERASE
+  uint32_t address, end_address, size, sector, offset;
+#elif LOADER_ERASE_AHEAD
+  uint32_t sector, end_sector;
+#endif
+  LOADER_PROFILE_SCOPE(LOADER_PROFILE_WRITE);
+  
   __set_PRIMASK(0);
-  if(BSP_W25Qx_Write(buffer, (Address & 0x0fffffff), Size) != W25Qx_OK)
+  Address &= 0x0fffffff;
+  
+#if LOADER_IN_PLACE_UPDATE
+  /* Compare the range with the flash one sector at a time, except where the
+     session erased it. Whole sectors that differ are gathered in a run
+     erased with the fewest commands, a range that only clears bits is
+     programmed in place, and a partial range that differs is merged with
+     the rest of its sector around the erase */
+  address = Address;
+  end_address = Address + Size;
+  run_start = Address;
+  while (address < end_address)
+  {
+    sector = address / MEMORY_SECTOR_SIZE;
+    offset = address % MEMORY_SECTOR_SIZE;
+    size = MEMORY_SECTOR_SIZE - offset;
+    if (size > end_address - address)
+      size = end_address - address;
+    
+    if (LOADER_SECTOR_TEST(LoaderSessionErased, sector) && offset >= LoaderBlankFrom[sector])
+    {
+      result = LOADER_CMP_SUBSET;
+    }
+    else
+    {
+      result = Loader_Compare(address, size, buffer);
+      Loader_Resolve(sector, result);
+    }
+    
+    if (result == LOADER_CMP_DIFFERENT && size == MEMORY_SECTOR_SIZE)
+    {
+      address += size;
+      buffer += size;
+      continue;
+    }
+    
+    if (Loader_Rewrite(run_start, address, buffer - (address - run_start)) != LOADER_OK)
+      return LOADER_FAIL;
+    
+    if (result == LOADER_CMP_DIFFERENT)
+    {
+      if (Loader_AutoErase(address, size, buffer) != LOADER_OK)
+        return LOADER_FAIL;
+    }
+    else if (result == LOADER_CMP_SUBSET || !LOADER_DIFFERENTIAL_REFLASH)
+    {
+      if (Loader_Program(address, size, buffer) != LOADER_OK)
+        return LOADER_FAIL;
+      if (LOADER_SECTOR_TEST(LoaderSessionErased, sector) && offset + size > LoaderBlankFrom[sector])
+        LoaderBlankFrom[sector] = (uint16_t)(offset + size);
+    }
+    
+    address += size;
+    buffer += size;
+    run_start = address;
+  }
+  
+  if (Loader_Rewrite(run_start, end_address, buffer - (end_address - run_start)) != LOADER_OK)
+    return LOADER_FAIL;
+#elif LOADER_AUTO_ERASE
+  /* Erase the sectors on their first write of the session, and again when
+     a range lands on data the session already programmed */
+  address = Address;
+  end_address = Address + Size;
+  while (address < end_address)
+  {
+    sector = address / MEMORY_SECTOR_SIZE;
+    offset = address % MEMORY_SECTOR_SIZE;
+    size = MEMORY_SECTOR_SIZE - offset;
+    if (size > end_address - address)
+      size = end_address - address;
+    
+    if (LOADER_SECTOR_TEST(LoaderSessionErased, sector) &&
+        (offset >= LoaderBlankFrom[sector] || Loader_IsBlank(address, size)))
+    {
+      if (Loader_Program(address, size, buffer) != LOADER_OK)
+        return LOADER_FAIL;
+      if (offset + size > LoaderBlankFrom[sector])
+        LoaderBlankFrom[sector] = (uint16_t)(offset + size);
+    }
+    else if (Loader_AutoErase(address, size, buffer) != LOADER_OK)
+    {
+      return LOADER_FAIL;
+    }
+    
+    address += size;
+    buffer += size;
+  }
+#else
+  if (Loader_Program(Address, Size, buffer) != LOADER_OK)
   {
     return LOADER_FAIL;
   }
+#if LOADER_ERASE_AHEAD
+  /* SectorErase erases these sectors again */
+  end_sector = (Address + Size + MEMORY_SECTOR_SIZE - 1) / MEMORY_SECTOR_SIZE;
+  for (sector = Address / MEMORY_SECTOR_SIZE; sector < end_sector; sector++)
+  {
+    LOADER_SECTOR_CLEAR(LoaderSessionErased, sector);
+  }
+#endif
+#endif
   
   __set_PRIMASK(1);
 	return LOADER_OK;
-} 
+}
 
 
 /**
@@ -117,7 +333,23 @@ KeepInCompilation int Write (uint32_t Address, uint32_t Size, uint8_t* buffer)
   */
 KeepInCompilation int MassErase (void)
 {  
+  LOADER_PROFILE_SCOPE(LOADER_PROFILE_MASS_ERASE);
+  
   __set_PRIMASK(0);
+  
+#if LOADER_SESSION_ERASE
+  memset(LoaderSessionErased, 0xFF, sizeof(LoaderSessionErased));
+  memset(LoaderBlankFrom, 0, sizeof(LoaderBlankFrom));
+#endif
+  
+  /* A virgin chip only costs a read pass */
+  if (Loader_IsBlank(0, MEMORY_FLASH_SIZE))
+  {
+    LoaderStats.BlankSectors += MEMORY_FLASH_SIZE / MEMORY_SECTOR_SIZE;
+    __set_PRIMASK(1);
+    return LOADER_OK;
+  }
+  
   if(BSP_W25Qx_Erase_Chip() != W25Qx_OK)
   {
     return LOADER_FAIL;
@@ -142,18 +374,48 @@ KeepInCompilation int MassErase (void)
   */
 KeepInCompilation int SectorErase (uint32_t EraseStartAddress, uint32_t EraseEndAddress)
 {      
+  uint32_t address, end_address;
+#if LOADER_ERASE_AHEAD
+  uint32_t run_start, run_end;
+#endif
+  LOADER_PROFILE_SCOPE(LOADER_PROFILE_SECTOR_ERASE);
+
   __set_PRIMASK(0);
-  EraseStartAddress = EraseStartAddress - EraseStartAddress % MEMORY_SECTOR_SIZE;
+  address = (EraseStartAddress & 0x0fffffff);
+  address -= address % MEMORY_SECTOR_SIZE;
+  /* End of the last sector touched by the range (exclusive) */
+  end_address = (EraseEndAddress & 0x0fffffff);
+  end_address += MEMORY_SECTOR_SIZE - end_address % MEMORY_SECTOR_SIZE;
   
-  while (EraseEndAddress >= EraseStartAddress)
+  /* With erase-ahead or W25Qx_ERASE_BEHIND the last erase is still running
+     on return, the next call that needs the chip waits for it */
+#if LOADER_ERASE_AHEAD
+  /* Leave out the sectors still blank from an erase of the session */
+  for (run_start = address; run_start < end_address; run_start = run_end)
   {
-    uint32_t address = (EraseStartAddress & 0x0fffffff);
+    run_end = run_start + MEMORY_SECTOR_SIZE;
+    if (LOADER_SESSION_BLANK(run_start / MEMORY_SECTOR_SIZE))
+      continue;
     
-    if(BSP_W25Qx_Erase_Block(address) == W25Qx_OK)
-      EraseStartAddress += MEMORY_SECTOR_SIZE;
-    else
+    while (run_end < end_address && !LOADER_SESSION_BLANK(run_end / MEMORY_SECTOR_SIZE))
+    {
+      run_end += MEMORY_SECTOR_SIZE;
+    }
+    
+    if (Loader_EraseSectors(run_start, run_end) != W25Qx_OK)
       return LOADER_FAIL;
   }
+#else
+  if (Loader_EraseSectors(address, end_address) != W25Qx_OK)
+    return LOADER_FAIL;
+#endif
+#if LOADER_SESSION_ERASE
+  for (; address < end_address; address += MEMORY_SECTOR_SIZE)
+  {
+    LOADER_SECTOR_SET(LoaderSessionErased, address / MEMORY_SECTOR_SIZE);
+    LoaderBlankFrom[address / MEMORY_SECTOR_SIZE] = 0;
+  }
+#endif
   
   __set_PRIMASK(1);
   return LOADER_OK;	
@@ -173,79 +435,17 @@ KeepInCompilation int SectorErase (uint32_t EraseStartAddress, uint32_t EraseEnd
   */
 KeepInCompilation uint32_t CheckSum(uint32_t StartAddress, uint32_t Size, uint32_t InitVal)
 {
-  uint8_t missalignementAddress = StartAddress%4;
-  uint8_t missalignementSize = Size ;
-	int cnt;
-  uint32_t Val;
-  uint8_t value;
-
-  StartAddress-=StartAddress%4;
-  Size += (Size%4==0)?0:4-(Size%4);
-  
-  for(cnt=0; cnt<Size ; cnt+=4)
-  {  
-    Read(StartAddress, 1, &value);
-    Val = value;
-    Read((StartAddress + 1), 1, &value);
-    Val += value<<8;
-    Read((StartAddress + 2), 1, &value);
-    Val += value<<16;
-    Read((StartAddress + 3), 1, &value);
-    Val += value<<24;
-    
-    if(missalignementAddress)
-    {
-      switch (missalignementAddress)
-      {
-        case 1:
-          InitVal += (uint8_t) (Val>>8 & 0xff);
-          InitVal += (uint8_t) (Val>>16 & 0xff);
-          InitVal += (uint8_t) (Val>>24 & 0xff);
-          missalignementAddress-=1;
-          break;
-        case 2:
-          InitVal += (uint8_t) (Val>>16 & 0xff);
-          InitVal += (uint8_t) (Val>>24 & 0xff);
-          missalignementAddress-=2;
-          break;
-        case 3:   
-          InitVal += (uint8_t) (Val>>24 & 0xff);
-          missalignementAddress-=3;
-          break;
-      }  
-    }
-    else if((Size-missalignementSize)%4 && (Size-cnt) <=4)
-    {
-      switch (Size-missalignementSize)
-      {
-        case 1:
-          InitVal += (uint8_t) Val;
-          InitVal += (uint8_t) (Val>>8 & 0xff);
-          InitVal += (uint8_t) (Val>>16 & 0xff);
-          missalignementSize-=1;
-          break;
-        case 2:
-          InitVal += (uint8_t) Val;
-          InitVal += (uint8_t) (Val>>8 & 0xff);
-          missalignementSize-=2;
-          break;
-        case 3:   
-          InitVal += (uint8_t) Val;
-          missalignementSize-=3;
-          break;
-      } 
-    }
-    else
-    {
-      InitVal += (uint8_t) Val;
-      InitVal += (uint8_t) (Val>>8 & 0xff);
-      InitVal += (uint8_t) (Val>>16 & 0xff);
-      InitVal += (uint8_t) (Val>>24 & 0xff);
-    }
-    
-    StartAddress += 4;
-  }
+  uint32_t end_address;
+  LOADER_PROFILE_SCOPE(LOADER_PROFILE_CHECKSUM);
+  
+  Loader_CheckSumRange(StartAddress, Size, &StartAddress, &end_address);
+  if (StartAddress == end_address)
+    return InitVal;
+  
+  __set_PRIMASK(0);
+  InitVal = Loader_SumRange(StartAddress, end_address - StartAddress, InitVal);
   
+  __set_PRIMASK(1);
   return (InitVal);
 }
 
@@ -266,24 +466,792 @@ KeepInCompilation uint32_t CheckSum(uint32_t StartAddress, uint32_t Size, uint32
   */
 KeepInCompilation uint64_t Verify (uint32_t MemoryAddr, uint32_t RAMBufferAddr, uint32_t Size, uint32_t missalignement)
 {
-  uint32_t InitVal = 0;
-  uint32_t VerifiedData = 0;
-  uint8_t TmpBuffer = 0x00;
-	uint64_t checksum;
+  uint8_t* flash;
+  uint32_t verify_start, verify_end, sum_start, sum_end;
+  uint32_t address, end_address, chunk, chunk_end, start, end, failed, i;
+  uint64_t checksum = 0;
+  LOADER_PROFILE_SCOPE(LOADER_PROFILE_VERIFY);
   
   Size *= 4;
-        
-  checksum = CheckSum((uint32_t)MemoryAddr + (missalignement & 0xf), Size - ((missalignement >> 16) & 0xF), InitVal);
-
-  while (Size>VerifiedData)
+  failed = Size;
+  
+  /* A single read stream covers the compared range and the checksum range */
+  Loader_CheckSumRange(MemoryAddr + (missalignement & 0xf), Size - ((missalignement >> 16) & 0xF), &sum_start, &sum_end);
+  verify_start = MemoryAddr & 0x0fffffff;
+  verify_end = verify_start + Size;
+  address = verify_start;
+  end_address = verify_end;
+  if (sum_start != sum_end)
+  {
+    address = (sum_start < address) ? sum_start : address;
+    end_address = (sum_end > end_address) ? sum_end : end_address;
+  }
+  
+  __set_PRIMASK(0);
+  /* The scratch halves are compared and summed while the DMA fills the
+     other one */
+  if (address < end_address &&
+      BSP_W25Qx_Stream_Start(address, end_address - address, (uint8_t*)LoaderScratch, LOADER_SCRATCH_SIZE / 2) != W25Qx_OK)
   {
-    Read((MemoryAddr + VerifiedData), 1, &TmpBuffer);
-         
-    if (TmpBuffer != *((uint8_t*)RAMBufferAddr + VerifiedData))
-      return ((checksum<<32) + MemoryAddr + VerifiedData);
-        
-    VerifiedData++;  
+    return MemoryAddr;
   }
-       
+  
+  for (; address < end_address; address = chunk_end)
+  {
+    if (BSP_W25Qx_Stream_Next(&flash, &chunk) != W25Qx_OK)
+    {
+      BSP_W25Qx_Stream_Stop();
+      /* Fail on the first byte not verified yet */
+      if (failed == Size)
+        failed = (address > verify_start) ? address - verify_start : 0;
+      return ((checksum<<32) + MemoryAddr + failed);
+    }
+    chunk_end = address + chunk;
+    
+    /* Compare up to the first difference */
+    start = (address > verify_start) ? address : verify_start;
+    end = (chunk_end < verify_end) ? chunk_end : verify_end;
+    if (failed == Size && start < end)
+    {
+      i = Loader_FindMismatch(flash + (start - address), (const uint8_t*)(uintptr_t)RAMBufferAddr + (start - verify_start), end - start);
+      if (i < end - start)
+        failed = start - verify_start + i;
+    }
+    
+    /* Add up the part in the checksum range */
+    start = (address > sum_start) ? address : sum_start;
+    end = (chunk_end < sum_end) ? chunk_end : sum_end;
+    if (start < end)
+      checksum = Loader_SumBytes(flash + (start - address), end - start, (uint32_t)checksum);
+    
+    /* Stop once the difference is found and the checksum complete */
+    if (failed != Size && chunk_end >= sum_end)
+      break;
+  }
+  
+  BSP_W25Qx_Stream_Stop();
+  __set_PRIMASK(1);
+  
+  if (failed != Size)
+    return ((checksum<<32) + MemoryAddr + failed);
+  
   return (checksum<<32);
 }
+
+
+#if LOADER_CRC32
+/**
+  * Description :
+  * Calculates the CRC-32 of a memory zone, as zlib crc32() does
+  * Inputs    :
+  *      StartAddress  : Flash start address
+  *      Size          : Size in bytes
+  *      InitVal       : CRC-32 of the data before the zone, 0 to start
+  * outputs   :
+  *     R0             : CRC-32 value
+  * Note: Not used by STM32CubeProgrammer, called by the host tools
+  */
+KeepInCompilation uint32_t Crc32 (uint32_t StartAddress, uint32_t Size, uint32_t InitVal)
+{
+  uint8_t* data;
+  uint32_t chunk;
+  LOADER_PROFILE_SCOPE(LOADER_PROFILE_CRC32);
+  
+  StartAddress &= 0x0fffffff;
+  
+  __set_PRIMASK(0);
+  /* A read failure returns a CRC the host cannot match */
+  if (Size > 0 &&
+      BSP_W25Qx_Stream_Start(StartAddress, Size, (uint8_t*)LoaderScratch, LOADER_SCRATCH_SIZE / 2) != W25Qx_OK)
+  {
+    return ~InitVal;
+  }
+  
+  while (Size > 0)
+  {
+    if (BSP_W25Qx_Stream_Next(&data, &chunk) != W25Qx_OK)
+    {
+      BSP_W25Qx_Stream_Stop();
+      return ~InitVal;
+    }
+    
+    InitVal = Loader_Crc32Bytes(data, chunk, InitVal);
+    Size -= chunk;
+  }
+  
+  BSP_W25Qx_Stream_Stop();
+  __set_PRIMASK(1);
+  return InitVal;
+}
+#endif
+
+
+/**
+  * Description :
+  * Compute the flash range the ST checksum of CheckSum covers. The sum
+  * covers Size rounded up to words from the aligned start address, without
+  * the head bytes of the first word before StartAddress. The last word
+  * drops the padding bytes, unless it is also a misaligned first word.
+  * For Size >= 256 the whole last word is dropped: the original word loop
+  * tracked the size in a uint8_t and the host expects that result.
+  * Inputs    :
+  *      StartAddress  : Flash start address
+  *      Size          : Length in bytes
+  *      Begin         : Set to the first flash address summed
+  *      End           : Set to the end of the summed range (exclusive),
+  *                      equal to Begin when there is nothing to sum
+  * outputs   :
+  *     None
+  */
+static void Loader_CheckSumRange(uint32_t StartAddress, uint32_t Size, uint32_t* Begin, uint32_t* End)
+{
+  uint32_t head = StartAddress % 4;
+  uint32_t padding = (Size % 4 == 0) ? 0 : 4 - Size % 4;
+  
+  StartAddress &= 0x0fffffff;
+  *Begin = StartAddress;
+  *End = StartAddress;
+  if (Size == 0)
+    return;
+  
+  *End = StartAddress - head + Size + padding;
+  if (padding != 0 && (head == 0 || Size + padding > 4))
+    *End -= (Size < 256) ? padding : 4;
+}
+
+
+/**
+  * Description :
+  * Program a range, leaving out the pages that only hold the erase value.
+  * The data around them is programmed in runs of consecutive pages.
+  * Inputs    :
+  *      Address       : Flash address
+  *      Size          : Length in bytes
+  *      Buffer        : Data to program
+  * outputs   :
+  *     R0             : "1" : Operation succeeded
+  *                      "0" : Operation failure
+  */
+static int Loader_Program(uint32_t Address, uint32_t Size, uint8_t* Buffer)
+{
+  uint32_t end_address, page_end, run_start;
+  
+  end_address = Address + Size;
+  run_start = Address;
+  
+  while (Address < end_address)
+  {
+    page_end = Address - Address % MEMORY_PAGE_SIZE + MEMORY_PAGE_SIZE;
+    if (page_end > end_address)
+      page_end = end_address;
+    
+    if (Loader_IsErasedData(Buffer + (Address - run_start), page_end - Address))
+    {
+      if (Address > run_start &&
+          BSP_W25Qx_Write(Buffer, run_start, Address - run_start) != W25Qx_OK)
+      {
+        return LOADER_FAIL;
+      }
+      
+      LoaderStats.BlankPages++;
+      Buffer += page_end - run_start;
+      run_start = page_end;
+    }
+    
+    Address = page_end;
+  }
+  
+  if (end_address > run_start &&
+      BSP_W25Qx_Write(Buffer, run_start, end_address - run_start) != W25Qx_OK)
+  {
+    return LOADER_FAIL;
+  }
+  
+  return LOADER_OK;
+}
+
+
+/**
+  * Description :
+  * Erase the sectors of a range that do not already read blank
+  * Inputs    :
+  *      Address       : Flash address, sector aligned
+  *      EndAddress    : End of the range to erase (exclusive), sector aligned
+  * outputs   :
+  *     R0             : W25Qx status
+  */
+static uint8_t Loader_EraseSectors(uint32_t Address, uint32_t EndAddress)
+{
+  uint32_t run_end;
+  uint8_t status;
+  
+  while (Address < EndAddress)
+  {
+    /* Sectors already erased are left alone */
+    if (Loader_IsBlank(Address, MEMORY_SECTOR_SIZE))
+    {
+      LoaderStats.BlankSectors++;
+      Address += MEMORY_SECTOR_SIZE;
+      continue;
+    }
+    
+    /* Erase the run of sectors up to the next blank one */
+    run_end = Address + MEMORY_SECTOR_SIZE;
+    while (run_end < EndAddress && !Loader_IsBlank(run_end, MEMORY_SECTOR_SIZE))
+    {
+      run_end += MEMORY_SECTOR_SIZE;
+    }
+    
+    status = Loader_EraseRange(Address, run_end);
+    if (status != W25Qx_OK)
+      return status;
+    
+    Address = run_end;
+    if (Address < EndAddress)
+    {
+      /* The sector that ended the run is blank */
+      LoaderStats.BlankSectors++;
+      Address += MEMORY_SECTOR_SIZE;
+    }
+  }
+  
+  return W25Qx_OK;
+}
+
+
+/**
+  * Description :
+  * Erase a sector aligned range with the fewest 64KB, 32KB and 4KB erases
+  * Inputs    :
+  *      Address       : Flash address, sector aligned
+  *      EndAddress    : End of the range to erase (exclusive), sector aligned
+  * outputs   :
+  *     R0             : W25Qx status
+  */
+static uint8_t Loader_EraseRange(uint32_t Address, uint32_t EndAddress)
+{
+  uint32_t size;
+  uint8_t status;
+  
+  while (Address < EndAddress)
+  {
+    size = Loader_EraseSize(Address, EndAddress);
+    
+    status = Loader_Erase(Address, size);
+    if (status != W25Qx_OK)
+      return status;
+    
+    Address += size;
+  }
+  
+  return W25Qx_OK;
+}
+
+
+/**
+  * Description :
+  * Pick the largest erase granularity aligned on Address that does not go
+  * past EndAddress
+  * Inputs    :
+  *      Address       : Flash address of the next area to erase
+  *      EndAddress    : End of the range to erase (exclusive)
+  * outputs   :
+  *     R0             : Erase size in bytes
+  */
+static uint32_t Loader_EraseSize(uint32_t Address, uint32_t EndAddress)
+{
+  if ((Address % MEMORY_BLOCK_SIZE) == 0 && (EndAddress - Address) >= MEMORY_BLOCK_SIZE)
+    return MEMORY_BLOCK_SIZE;
+  
+  if ((Address % MEMORY_BLOCK32_SIZE) == 0 && (EndAddress - Address) >= MEMORY_BLOCK32_SIZE)
+    return MEMORY_BLOCK32_SIZE;
+  
+  return MEMORY_SECTOR_SIZE;
+}
+
+
+/**
+  * Description :
+  * Erase one area with the command matching its size
+  * Inputs    :
+  *      Address       : Flash address, aligned on Size
+  *      Size          : MEMORY_BLOCK_SIZE, MEMORY_BLOCK32_SIZE or MEMORY_SECTOR_SIZE
+  * outputs   :
+  *     R0             : W25Qx status
+  */
+static uint8_t Loader_Erase(uint32_t Address, uint32_t Size)
+{
+#if LOADER_ERASE_AHEAD
+  /* Left running, the next command waits for it */
+  LoaderStats.AheadErases++;
+  switch (Size)
+  {
+    case MEMORY_BLOCK_SIZE:
+      return BSP_W25Qx_Start_Erase_Block64K(Address);
+    case MEMORY_BLOCK32_SIZE:
+      return BSP_W25Qx_Start_Erase_Block32K(Address);
+    default:
+      return BSP_W25Qx_Start_Erase_Block(Address);
+  }
+#else
+  switch (Size)
+  {
+    case MEMORY_BLOCK_SIZE:
+      return BSP_W25Qx_Erase_Block64K(Address);
+    case MEMORY_BLOCK32_SIZE:
+      return BSP_W25Qx_Erase_Block32K(Address);
+    default:
+      return BSP_W25Qx_Erase_Block(Address);
+  }
+#endif
+}
+
+
+/**
+  * Description :
+  * Check that a flash area reads as erased, streaming it through the
+  * scratch buffer one word at a time. Stops at the first programmed word.
+  * Inputs    :
+  *      Address       : Flash address
+  *      Size          : Length in bytes
+  * outputs   :
+  *     R0             : 1 : Area is blank
+  *                      0 : Area is programmed or could not be read
+  */
+static int Loader_IsBlank(uint32_t Address, uint32_t Size)
+{
+  uint32_t chunk, i;
+  
+  while (Size > 0)
+  {
+    chunk = (Size > LOADER_SCRATCH_SIZE) ? LOADER_SCRATCH_SIZE : Size;
+    
+    if (BSP_W25Qx_Read((uint8_t*)LoaderScratch, Address, chunk) != W25Qx_OK)
+      return 0;
+    
+    for (i = 0; i < chunk / 4; i++)
+    {
+      if (LoaderScratch[i] != LOADER_ERASED_WORD)
+        return 0;
+    }
+    
+    if (!Loader_IsErasedData((uint8_t*)LoaderScratch + chunk - chunk % 4, chunk % 4))
+      return 0;
+    
+    Address += chunk;
+    Size -= chunk;
+  }
+  
+  return 1;
+}
+
+
+/**
+  * Description :
+  * Check whether a RAM buffer only holds the erase value, a word at a time
+  * once the pointer is aligned
+  * Inputs    :
+  *      Data          : RAM buffer
+  *      Size          : Length in bytes
+  * outputs   :
+  *     R0             : 1 : Programming the buffer would not change the flash
+  *                      0 : Buffer holds data
+  */
+static int Loader_IsErasedData(const uint8_t* Data, uint32_t Size)
+{
+  const uint32_t* word;
+  
+  while (Size > 0 && ((uintptr_t)Data % 4) != 0)
+  {
+    if (*Data++ != MEMORY_ERASE_VALUE)
+      return 0;
+    Size--;
+  }
+  
+  for (word = (const uint32_t*)Data; Size >= 4; Size -= 4)
+  {
+    if (*word++ != LOADER_ERASED_WORD)
+      return 0;
+  }
+  
+  for (Data = (const uint8_t*)word; Size > 0; Size--)
+  {
+    if (*Data++ != MEMORY_ERASE_VALUE)
+      return 0;
+  }
+  
+  return 1;
+}
+
+
+/**
+  * Description :
+  * Add up the bytes of a flash area, streaming it through the halves of
+  * the scratch buffer. Stops at the first read failure.
+  * Inputs    :
+  *      Address       : Flash address
+  *      Size          : Length in bytes
+  *      Sum           : Initial value
+  * outputs   :
+  *     R0             : Sum of the bytes read
+  */
+static uint32_t Loader_SumRange(uint32_t Address, uint32_t Size, uint32_t Sum)
+{
+  uint8_t* data;
+  uint32_t chunk;
+  
+  if (BSP_W25Qx_Stream_Start(Address, Size, (uint8_t*)LoaderScratch, LOADER_SCRATCH_SIZE / 2) != W25Qx_OK)
+    return Sum;
+  
+  while (Size > 0)
+  {
+    if (BSP_W25Qx_Stream_Next(&data, &chunk) != W25Qx_OK)
+      break;
+    
+    Sum = Loader_SumBytes(data, chunk, Sum);
+    Size -= chunk;
+  }
+  
+  BSP_W25Qx_Stream_Stop();
+  return Sum;
+}
+
+
+/**
+  * Description :
+  * Add up the bytes of a RAM buffer. With LOADER_SIMD_CHECKSUM the aligned
+  * words go through USADA8, which adds the absolute differences of the
+  * four bytes with 0 to the accumulator: the same sum, modulo 2^32, as the
+  * byte loop.
+  * Inputs    :
+  *      Data          : RAM buffer
+  *      Size          : Length in bytes
+  *      Sum           : Initial value
+  * outputs   :
+  *     R0             : Sum of the bytes
+  */
+static uint32_t Loader_SumBytes(const uint8_t* Data, uint32_t Size, uint32_t Sum)
+{
+#if LOADER_SIMD_CHECKSUM
+  const uint32_t* word;
+  
+  while (Size > 0 && ((uintptr_t)Data % 4) != 0)
+  {
+    Sum += *Data++;
+    Size--;
+  }
+  
+  for (word = (const uint32_t*)Data; Size >= 16; Size -= 16)
+  {
+    Sum = __USADA8(word[0], 0, Sum);
+    Sum = __USADA8(word[1], 0, Sum);
+    Sum = __USADA8(word[2], 0, Sum);
+    Sum = __USADA8(word[3], 0, Sum);
+    word += 4;
+  }
+  
+  for (; Size >= 4; Size -= 4)
+  {
+    Sum = __USADA8(*word++, 0, Sum);
+  }
+  
+  Data = (const uint8_t*)word;
+#endif
+  
+  while (Size > 0)
+  {
+    Sum += *Data++;
+    Size--;
+  }
+  
+  return Sum;
+}
+
+
+/**
+  * Description :
+  * Find the first difference between flash content read into RAM and the
+  * expected data, a word at a time when both buffers are aligned
+  * Inputs    :
+  *      Flash         : Flash content
+  *      Data          : Expected data
+  *      Size          : Length in bytes
+  * outputs   :
+  *     R0             : Offset of the first difference, Size when equal
+  */
+static uint32_t Loader_FindMismatch(const uint8_t* Flash, const uint8_t* Data, uint32_t Size)
+{
+  uint32_t i = 0;
+  
+  if ((((uintptr_t)Flash | (uintptr_t)Data) % 4) == 0)
+  {
+    for (; Size - i >= 4; i += 4)
+    {
+      if (*(const uint32_t*)(Flash + i) != *(const uint32_t*)(Data + i))
+        break;
+    }
+  }
+  
+  for (; i < Size; i++)
+  {
+    if (Flash[i] != Data[i])
+      break;
+  }
+  
+  return i;
+}
+
+
+#if LOADER_CRC32
+/**
+  * Description :
+  * Continue a CRC-32 over a RAM buffer. The CRC unit computes the non
+  * reflected CRC of the bit reversed bytes, so it is seeded with the bit
+  * reversed state and words are fed most significant byte first.
+  * Inputs    :
+  *      Data          : RAM buffer, word aligned
+  *      Size          : Length in bytes
+  *      Crc           : CRC-32 of the data before the buffer
+  * outputs   :
+  *     R0             : CRC-32 including the buffer
+  */
+static uint32_t Loader_Crc32Bytes(const uint8_t* Data, uint32_t Size, uint32_t Crc)
+{
+#if LOADER_CRC32_HARDWARE
+  const uint32_t* word = (const uint32_t*)Data;
+  
+  CRC->INIT = __RBIT(~Crc);
+  CRC->CR |= CRC_CR_RESET;
+  
+  for (; Size >= 4; Size -= 4)
+  {
+    CRC->DR = __REV(*word++);
+  }
+  
+  for (Data = (const uint8_t*)word; Size > 0; Size--)
+  {
+    *(__IO uint8_t*)&CRC->DR = *Data++;
+  }
+  
+  return ~CRC->DR;
+#else
+  Crc = ~Crc;
+  
+  while (Size > 0)
+  {
+    Crc ^= *Data++;
+    Crc = (Crc >> 4) ^ LoaderCrc32Table[Crc & 0x0F];
+    Crc = (Crc >> 4) ^ LoaderCrc32Table[Crc & 0x0F];
+    Size--;
+  }
+  
+  return ~Crc;
+#endif
+}
+#endif
+
+
+#if LOADER_IN_PLACE_UPDATE
+/**
+  * Description :
+  * Erase a run of whole sectors that all differ from their data with the
+  * erase planner, and program the data back
+  * Inputs    :
+  *      Address       : Flash address, sector aligned
+  *      EndAddress    : End of the run (exclusive), sector aligned, equal
+  *                      to Address when there is nothing to rewrite
+  *      Buffer        : Data of the run
+  * outputs   :
+  *     R0             : "1" : Operation succeeded
+  *                      "0" : Operation failure
+  */
+static int Loader_Rewrite(uint32_t Address, uint32_t EndAddress, uint8_t* Buffer)
+{
+  uint32_t sector;
+  
+  if (Address == EndAddress)
+    return LOADER_OK;
+  
+  if (Loader_EraseRange(Address, EndAddress) != W25Qx_OK)
+    return LOADER_FAIL;
+  
+  for (sector = Address / MEMORY_SECTOR_SIZE; sector < EndAddress / MEMORY_SECTOR_SIZE; sector++)
+  {
+    LOADER_SECTOR_SET(LoaderSessionErased, sector);
+    LoaderBlankFrom[sector] = MEMORY_SECTOR_SIZE;
+  }
+  
+  return Loader_Program(Address, EndAddress - Address, Buffer);
+}
+
+
+/**
+  * Description :
+  * Record the comparison result of a range written into a sector. The
+  * sector keeps the worst result of the session and is counted once, in
+  * the statistic of that result.
+  * Inputs    :
+  *      Sector        : Sector number
+  *      Result        : LOADER_CMP_SAME, LOADER_CMP_SUBSET or LOADER_CMP_DIFFERENT
+  * outputs   :
+  *     None
+  */
+static void Loader_Resolve(uint32_t Sector, int Result)
+{
+  int verdict = LoaderVerdict[Sector];
+  
+  if (verdict != LOADER_CMP_NONE)
+  {
+    if (verdict >= Result)
+      return;
+    (*Loader_VerdictStat(verdict))--;
+  }
+  
+  LoaderVerdict[Sector] = (uint8_t)Result;
+  (*Loader_VerdictStat(Result))++;
+}
+
+
+/**
+  * Description :
+  * Statistic counting the sectors of a comparison result
+  * Inputs    :
+  *      Verdict       : LOADER_CMP_SAME, LOADER_CMP_SUBSET or LOADER_CMP_DIFFERENT
+  * outputs   :
+  *     R0             : Field of LoaderStats
+  */
+static volatile uint32_t* Loader_VerdictStat(int Verdict)
+{
+  if (Verdict == LOADER_CMP_SAME && LOADER_DIFFERENTIAL_REFLASH)
+    return &LoaderStats.UnchangedSectors;
+  
+  if (Verdict != LOADER_CMP_DIFFERENT)
+    return &LoaderStats.BitClearedSectors;
+  
+  return &LoaderStats.RewrittenSectors;
+}
+#endif
+
+
+#if LOADER_IN_PLACE_UPDATE
+/**
+  * Description :
+  * Compare a buffer with the current flash content, streaming the flash
+  * through the scratch buffer. Words are compared at once when the buffer
+  * is aligned, and the scan stops as soon as a bit would go from 0 to 1.
+  * Inputs    :
+  *      Address       : Flash address
+  *      Size          : Length in bytes
+  *      Buffer        : New data
+  * outputs   :
+  *     R0             : LOADER_CMP_SAME, LOADER_CMP_SUBSET (old & new == new)
+  *                      or LOADER_CMP_DIFFERENT (also on read failure)
+  */
+static int Loader_Compare(uint32_t Address, uint32_t Size, const uint8_t* Buffer)
+{
+  const uint8_t* old = (const uint8_t*)LoaderScratch;
+  const uint32_t* data;
+  uint32_t chunk, i;
+  int result = LOADER_CMP_SAME;
+  
+  while (Size > 0)
+  {
+    chunk = (Size > LOADER_SCRATCH_SIZE) ? LOADER_SCRATCH_SIZE : Size;
+    
+    if (BSP_W25Qx_Read((uint8_t*)LoaderScratch, Address, chunk) != W25Qx_OK)
+      return LOADER_CMP_DIFFERENT;
+    
+    i = 0;
+    if (((uintptr_t)Buffer % 4) == 0)
+    {
+      for (data = (const uint32_t*)Buffer; i < chunk / 4; i++)
+      {
+        if (LoaderScratch[i] == data[i])
+          continue;
+        if ((LoaderScratch[i] & data[i]) != data[i])
+          return LOADER_CMP_DIFFERENT;
+        result = LOADER_CMP_SUBSET;
+      }
+      i *= 4;
+    }
+    
+    for (; i < chunk; i++)
+    {
+      if (old[i] == Buffer[i])
+        continue;
+      if ((old[i] & Buffer[i]) != Buffer[i])
+        return LOADER_CMP_DIFFERENT;
+      result = LOADER_CMP_SUBSET;
+    }
+    
+    Address += chunk;
+    Buffer += chunk;
+    Size -= chunk;
+  }
+  
+  return result;
+}
+#endif
+
+
+#if LOADER_WRITE_ERASE
+/**
+  * Description :
+  * Erase the sector a range lands in and program the range. When the range
+  * only covers part of the sector, the sector is read into
+  * LoaderSectorImage and the data merged in, so the content around the
+  * range is programmed back with it. Sectors that already read blank are
+  * not erased.
+  * Inputs    :
+  *      Address       : Flash address
+  *      Size          : Length in bytes, within one sector
+  *      Buffer        : Data to program
+  * outputs   :
+  *     R0             : "1" : Operation succeeded
+  *                      "0" : Operation failure
+  */
+static int Loader_AutoErase(uint32_t Address, uint32_t Size, uint8_t* Buffer)
+{
+  uint32_t sector_start = Address - Address % MEMORY_SECTOR_SIZE;
+  uint32_t sector = sector_start / MEMORY_SECTOR_SIZE;
+  int blank;
+  
+  if (Size < MEMORY_SECTOR_SIZE)
+  {
+    if (BSP_W25Qx_Read((uint8_t*)LoaderSectorImage, sector_start, MEMORY_SECTOR_SIZE) != W25Qx_OK)
+      return LOADER_FAIL;
+    
+    blank = Loader_IsErasedData((uint8_t*)LoaderSectorImage, MEMORY_SECTOR_SIZE);
+    if (!blank)
+    {
+      /* Program the whole sector back with the new data in place */
+      memcpy((uint8_t*)LoaderSectorImage + (Address - sector_start), Buffer, Size);
+      Address = sector_start;
+      Size = MEMORY_SECTOR_SIZE;
+      Buffer = (uint8_t*)LoaderSectorImage;
+    }
+  }
+  else
+  {
+    blank = Loader_IsBlank(sector_start, MEMORY_SECTOR_SIZE);
+  }
+  
+  if (blank)
+  {
+    LoaderStats.BlankSectors++;
+  }
+  else
+  {
+    if (BSP_W25Qx_Erase_Block(sector_start) != W25Qx_OK)
+      return LOADER_FAIL;
+#if LOADER_AUTO_ERASE
+    LoaderStats.AutoErasedSectors++;
+#endif
+  }
+  
+  /* Only the part after the programmed range is known to be blank */
+  LOADER_SECTOR_SET(LoaderSessionErased, sector);
+  LoaderBlankFrom[sector] = (uint16_t)(Address + Size - sector_start);
+  return Loader_Program(Address, Size, Buffer);
+}
+#endif
@@ -14,19 +14,87 @@
 
 #include "W25QXX.h"
 #include "spi.h"
+#include "W25Qx_SPI.h"
+#include "Loader_Profile.h"
 
 //* set spi handler define
 #define hspix  hspi3
 
+//* largest command and response of BSP_W25Qx_Exchange on the HAL
+#define W25Qx_EXCHANGE_SIZE 8
+
+//* DMA transfer state, advanced from the SPI callbacks
+#define W25Qx_DMA_DONE      ((uint8_t)0x00)
+#define W25Qx_DMA_BUSY      ((uint8_t)0x01)
+#define W25Qx_DMA_FAILED    ((uint8_t)0x02)
+
+static uint8_t *W25Qx_DmaData;
+static uint16_t W25Qx_DmaDataSize;
+static volatile uint8_t W25Qx_DmaState = W25Qx_DMA_DONE;
+
+//* program/erase left running by the last call, checked by the next one
+static uint32_t W25Qx_PendingTimeout;
+
+//* stream buffer half state, advanced from the SPI callbacks
+#define W25Qx_HALF_FREE     ((uint8_t)0x00)
+#define W25Qx_HALF_DMA      ((uint8_t)0x01)
+#define W25Qx_HALF_READY    ((uint8_t)0x02)
+#define W25Qx_HALF_CPU      ((uint8_t)0x03)
+
+static uint8_t *W25Qx_StreamBuffer;
+static uint16_t W25Qx_StreamHalfSize;
+static uint32_t W25Qx_StreamLeft;
+static uint8_t W25Qx_StreamNext;
+static volatile uint8_t W25Qx_StreamActive;
+static volatile uint8_t W25Qx_StreamFill;
+static volatile uint8_t W25Qx_StreamSpan;
+static volatile uint8_t W25Qx_StreamState[2];
+static volatile uint16_t W25Qx_StreamSize[2];
+
+#if W25Qx_TRACE
+//* chip select cycles, dumped over SWD
+__attribute__((used)) W25Qx_TraceTypeDef W25Qx_Trace;
+static volatile uint8_t W25Qx_TraceOpen;
+
+#define W25Qx_TRACE_BEGIN(Opcode, Address, Length)  BSP_W25Qx_TraceBegin((Opcode), (Address), (Length))
+#define W25Qx_TRACE_END(Result)                     BSP_W25Qx_TraceEnd(Result)
+#else
+#define W25Qx_TRACE_BEGIN(Opcode, Address, Length)  ((void)0)
+#define W25Qx_TRACE_END(Result)                     ((void)0)
+#endif
+
 uint8_t BSP_W25Qx_Init(void);
-static void	BSP_W25Qx_Reset(void);
+static uint8_t	BSP_W25Qx_Reset(void);
 static uint8_t BSP_W25Qx_GetStatus(void);
+static uint8_t BSP_W25Qx_WaitForReady(uint32_t Timeout);
+static void BSP_W25Qx_SetClock(uint32_t Prescaler);
+static uint8_t BSP_W25Qx_Exchange(uint8_t *pCmd, uint16_t CmdSize, uint8_t *pData, uint16_t Size);
+static uint8_t BSP_W25Qx_Command(uint8_t *pCmd, uint16_t CmdSize, uint8_t *pData, uint16_t Size);
+static uint8_t BSP_W25Qx_Transmit_DMA(uint8_t *pCmd, uint16_t CmdSize, uint8_t *pData, uint16_t Size);
+static uint8_t BSP_W25Qx_WaitDMA(uint32_t Timeout);
+static uint8_t BSP_W25Qx_StartRead(uint32_t ReadAddr, uint32_t Size);
+static void BSP_W25Qx_EndRead(uint8_t Result);
+static void BSP_W25Qx_StreamKick(void);
+#if W25Qx_TRACE
+static void BSP_W25Qx_TraceBegin(uint8_t Opcode, uint32_t Address, uint32_t Length);
+static void BSP_W25Qx_TraceEnd(uint8_t Result);
+#endif
 uint8_t BSP_W25Qx_WriteEnable(void);
-void BSP_W25Qx_Read_ID(uint8_t *ID);
+uint8_t BSP_W25Qx_Read_ID(uint8_t *ID);
 uint8_t BSP_W25Qx_Read(uint8_t* pData, uint32_t ReadAddr, uint32_t Size);
+uint8_t BSP_W25Qx_Stream_Start(uint32_t ReadAddr, uint32_t Size, uint8_t* pBuffer, uint16_t HalfSize);
+uint8_t BSP_W25Qx_Stream_Next(uint8_t** pData, uint32_t* Size);
+void BSP_W25Qx_Stream_Stop(void);
 uint8_t BSP_W25Qx_Write(uint8_t* pData, uint32_t WriteAddr, uint32_t Size);
 uint8_t BSP_W25Qx_Erase_Block(uint32_t Address);
+uint8_t BSP_W25Qx_Erase_Block32K(uint32_t Address);
+uint8_t BSP_W25Qx_Erase_Block64K(uint32_t Address);
 uint8_t BSP_W25Qx_Erase_Chip(void);
+uint8_t BSP_W25Qx_Start_Erase_Block(uint32_t Address);
+uint8_t BSP_W25Qx_Start_Erase_Block32K(uint32_t Address);
+uint8_t BSP_W25Qx_Start_Erase_Block64K(uint32_t Address);
+static uint8_t BSP_W25Qx_Erase(uint8_t Cmd, uint32_t Address, uint32_t Timeout);
+static uint8_t BSP_W25Qx_Erase_Start(uint8_t Cmd, uint32_t Address, uint32_t Timeout);
 
 /**
   * @brief  Initializes the W25Q80 interface.
@@ -34,24 +102,63 @@ uint8_t BSP_W25Qx_Erase_Chip(void);
   */
 uint8_t BSP_W25Qx_Init(void)
 { 
+	uint8_t status;
+	
+#if W25Qx_TRACE
+	/* The records are stamped with the cycle counter */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	W25Qx_Trace.Magic = W25Qx_TRACE_MAGIC;
+	W25Qx_Trace.Depth = W25Qx_TRACE_DEPTH;
+	W25Qx_Trace.Clock = SystemCoreClock;
+	W25Qx_TraceOpen = 0;
+	
+#endif
+#if W25Qx_DIRECT_SPI
+	/* Byte accesses to DR from here on */
+	W25Qx_SPI_Setup(hspix.Instance);
+	
+#endif
+	/* Do not reset the chip in the middle of a program or erase, the
+	   pending state may not have survived a reload of the loader. The
+	   longest one left running is an addressed erase, a chip still busy
+	   after that is missing or stuck (MISO high reads BUSY) */
+	W25Qx_PendingTimeout = 0;
+	status = BSP_W25Qx_WaitForReady(W25Q80_SECTOR_ERASE_MAX_TIME);
+	if (status != W25Qx_OK)
+	{
+		return status;
+	}
+	
 	/* Reset W25Qxxx */
-	BSP_W25Qx_Reset();
+	status = BSP_W25Qx_Reset();
+	if (status != W25Qx_OK)
+	{
+		return status;
+	}
 	
 	return BSP_W25Qx_GetStatus();
 }
 
 /**
   * @brief  This function reset the W25Qx.
-  * @retval None
+  *         Enable reset and reset are two instructions, each in its own
+  *         chip select cycle.
+  * @retval QSPI memory status
   */
-static void	BSP_W25Qx_Reset(void)
+static uint8_t	BSP_W25Qx_Reset(void)
 {
-	uint8_t cmd[2] = {RESET_ENABLE_CMD,RESET_MEMORY_CMD};
+	uint8_t cmd[1] = {RESET_ENABLE_CMD};
+	
+	/* Send the enable reset command */
+	if (BSP_W25Qx_Command(cmd, 1, NULL, 0) != W25Qx_OK)
+	{
+		return W25Qx_ERROR;
+	}
 	
-	W25Qx_Enable();
 	/* Send the reset command */
-	HAL_SPI_Transmit(&hspix, cmd, 2, W25Qx_TIMEOUT_VALUE);	
-	W25Qx_Disable();
+	cmd[0] = RESET_MEMORY_CMD;
+	return BSP_W25Qx_Command(cmd, 1, NULL, 0);
 }
 
 /**
@@ -63,12 +170,11 @@ static uint8_t BSP_W25Qx_GetStatus(void)
 	uint8_t cmd[] = {READ_STATUS_REG1_CMD};
 	uint8_t status;
 	
-	W25Qx_Enable();
-	/* Send the read status command */
-	HAL_SPI_Transmit(&hspix, cmd, 1, W25Qx_TIMEOUT_VALUE);	
-	/* Reception of the data */
-	HAL_SPI_Receive(&hspix, &status, 1, W25Qx_TIMEOUT_VALUE);
-	W25Qx_Disable();
+	/* Send the read status command and receive the register */
+	if (BSP_W25Qx_Command(cmd, 1, &status, 1) != W25Qx_OK)
+	{
+		return W25Qx_ERROR;
+	}
 	
 	/* Check the value of the register */
 	if((status & W25Q80_FSR_BUSY) != 0)
@@ -82,53 +188,136 @@ static uint8_t BSP_W25Qx_GetStatus(void)
 }
 
 /**
-  * @brief  This function send a Write Enable and wait it is effective.
-  * @retval None
+  * @brief  Waits until the W25Q80 clears its BUSY flag.
+  *         READ_STATUS_REG1_CMD is sent with the first status byte and the
+  *         status register is then clocked in continuously while the chip
+  *         stays selected, so each poll costs a single byte on the bus.
+  * @param  Timeout: Timeout in ms
+  * @retval W25Q80 memory status
   */
-uint8_t BSP_W25Qx_WriteEnable(void)
+static uint8_t BSP_W25Qx_WaitForReady(uint32_t Timeout)
 {
-	uint8_t cmd[] = {WRITE_ENABLE_CMD};
+	uint8_t cmd[] = {READ_STATUS_REG1_CMD};
+	uint8_t status;
 	uint32_t tickstart = HAL_GetTick();
-
-	/*Select the FLASH: Chip Select low */
+	LOADER_PROFILE_SCOPE(LOADER_PROFILE_W25QX_BUSY);
+	
+	W25Qx_TRACE_BEGIN(READ_STATUS_REG1_CMD, 0, 0);
 	W25Qx_Enable();
-	/* Send the read ID command */
-	HAL_SPI_Transmit(&hspix, cmd, 1, W25Qx_TIMEOUT_VALUE);	
-	/*Deselect the FLASH: Chip Select high */
-	W25Qx_Disable();
+	/* Send the read status command with the first poll */
+	if (BSP_W25Qx_Exchange(cmd, 1, &status, 1) != W25Qx_OK)
+	{
+		W25Qx_Disable();
+		W25Qx_TRACE_END(W25Qx_ERROR);
+		return W25Qx_ERROR;
+	}
 	
-	/* Wait the end of Flash writing */
-	while(BSP_W25Qx_GetStatus() == W25Qx_BUSY)
+	/* The flash repeats the status register until CS goes high */
+	while ((status & W25Q80_FSR_BUSY) != 0)
 	{
 		/* Check for the Timeout */
-		if((HAL_GetTick() - tickstart) > W25Qx_TIMEOUT_VALUE)
-		{        
+		if ((HAL_GetTick() - tickstart) > Timeout)
+		{
+			W25Qx_Disable();
+			W25Qx_TRACE_END(W25Qx_TIMEOUT);
 			return W25Qx_TIMEOUT;
 		}
+		
+		if (BSP_W25Qx_Exchange(NULL, 0, &status, 1) != W25Qx_OK)
+		{
+			W25Qx_Disable();
+			W25Qx_TRACE_END(W25Qx_ERROR);
+			return W25Qx_ERROR;
+		}
 	}
 	
+	W25Qx_Disable();
+	W25Qx_TRACE_END(W25Qx_OK);
+	return W25Qx_OK;
+}
+
+/**
+  * @brief  Waits for the program or erase left running by the previous call.
+  *         Every command entry point calls it first, so the busy time of a
+  *         deferred operation overlaps whatever happened in between.
+  * @retval W25Q80 memory status of the deferred operation
+  */
+uint8_t BSP_W25Qx_WaitPending(void)
+{
+	uint32_t timeout = W25Qx_PendingTimeout;
+	
+	if (timeout == 0)
+	{
+		return W25Qx_OK;
+	}
+	
+	W25Qx_PendingTimeout = 0;
+	return BSP_W25Qx_WaitForReady(timeout);
+}
+
+/**
+  * @brief  This function send a Write Enable.
+  *         Callers only issue it once the previous operation is finished, so
+  *         there is no busy wait here. With W25Qx_CHECK_WEL the WEL bit is
+  *         read back once, it is only latched when CS goes high.
+  * @retval W25Q80 memory status
+  */
+uint8_t BSP_W25Qx_WriteEnable(void)
+{
+	uint8_t cmd[] = {WRITE_ENABLE_CMD};
+#if W25Qx_CHECK_WEL
+	uint8_t status;
+#endif
+	LOADER_PROFILE_SCOPE(LOADER_PROFILE_W25QX_COMMAND);
+
+	/* Send the write enable command */
+	if (BSP_W25Qx_Command(cmd, 1, NULL, 0) != W25Qx_OK)
+	{
+		return W25Qx_ERROR;
+	}
+	
+#if W25Qx_CHECK_WEL
+	cmd[0] = READ_STATUS_REG1_CMD;
+	if (BSP_W25Qx_Command(cmd, 1, &status, 1) != W25Qx_OK)
+	{
+		return W25Qx_ERROR;
+	}
+	
+	if ((status & W25Q80_FSR_WREN) == 0)
+	{
+		return W25Qx_ERROR;
+	}
+#endif
+	
 	return W25Qx_OK;
 }
 
 /**
   * @brief  Read Manufacture/Device ID.
 	* @param  return value address
-  * @retval None
+  * @retval QSPI memory status
   */
-void BSP_W25Qx_Read_ID(uint8_t *ID)
+uint8_t BSP_W25Qx_Read_ID(uint8_t *ID)
 {
 	uint8_t cmd[4] = {READ_ID_CMD,0x00,0x00,0x00};
+	uint8_t status;
 	
-	W25Qx_Enable();
-	/* Send the read ID command */
-	HAL_SPI_Transmit(&hspix, cmd, 4, W25Qx_TIMEOUT_VALUE);	
-	/* Reception of the data */
-	HAL_SPI_Receive(&hspix,ID, 2, W25Qx_TIMEOUT_VALUE);
-	W25Qx_Disable();
+	status = BSP_W25Qx_WaitPending();
+	if (status != W25Qx_OK)
+	{
+		return status;
+	}
+	
+	/* Send the read ID command and receive the IDs */
+	return BSP_W25Qx_Command(cmd, 4, ID, 2);
 }
 
 /**
   * @brief  Reads an amount of data from the QSPI memory.
+  *         The data phase is received by DMA straight into pData, split in
+  *         W25Qx_DMA_CHUNK_SIZE transfers while the chip stays selected, so
+  *         any size up to the whole memory is read with a single command.
+  *         The read runs with W25Qx_READ_CMD at W25Qx_READ_PRESCALER.
   * @param  pData: Pointer to data to be read
   * @param  ReadAddr: Read start address
   * @param  Size: Size of data to read    
@@ -136,47 +325,288 @@ void BSP_W25Qx_Read_ID(uint8_t *ID)
   */
 uint8_t BSP_W25Qx_Read(uint8_t* pData, uint32_t ReadAddr, uint32_t Size)
 {
-	uint8_t cmd[4];
+	uint16_t current_size;
+	uint8_t status;
+
+	status = BSP_W25Qx_StartRead(ReadAddr, Size);
+	if (status != W25Qx_OK)
+	{
+		return status;
+	}
+	
+	/* Reception of the data, the flash keeps streaming while CS is low */
+	LOADER_PROFILE_BEGIN(data_start);
+	while (Size > 0)
+	{
+		current_size = (Size > W25Qx_DMA_CHUNK_SIZE) ? W25Qx_DMA_CHUNK_SIZE : (uint16_t)Size;
+		
+		W25Qx_DmaState = W25Qx_DMA_BUSY;
+		if (HAL_SPI_Receive_DMA(&hspix, pData, current_size) != HAL_OK)
+		{
+			W25Qx_DmaState = W25Qx_DMA_DONE;
+			BSP_W25Qx_EndRead(W25Qx_ERROR);
+			return W25Qx_ERROR;
+		}
+		
+		status = BSP_W25Qx_WaitDMA(W25Qx_TIMEOUT_VALUE);
+		if (status != W25Qx_OK)
+		{
+			BSP_W25Qx_EndRead(status);
+			return status;
+		}
+		
+		pData += current_size;
+		Size -= current_size;
+	}
+	LOADER_PROFILE_END(LOADER_PROFILE_W25QX_DATA, data_start);
+	
+	BSP_W25Qx_EndRead(W25Qx_OK);
+	return W25Qx_OK;
+}
+
+/**
+  * @brief  Starts reading an amount of data through a ping-pong buffer.
+  *         The buffer is split in two halves that SPI3 RX DMA fills in
+  *         turn while the caller processes the other one, the halves are
+  *         handed out in order by BSP_W25Qx_Stream_Next. When both halves
+  *         are free the DMA fills them in one transfer and the first one is
+  *         signaled by the half transfer callback.
+  *         The read runs with W25Qx_READ_CMD at W25Qx_READ_PRESCALER and
+  *         the chip stays selected until BSP_W25Qx_Stream_Stop.
+  * @param  ReadAddr: Read start address
+  * @param  Size: Size of data to read
+  * @param  pBuffer: Pointer to the buffer, 2 * HalfSize bytes
+  * @param  HalfSize: Size of each half
+  * @retval QSPI memory status
+  */
+uint8_t BSP_W25Qx_Stream_Start(uint32_t ReadAddr, uint32_t Size, uint8_t* pBuffer, uint16_t HalfSize)
+{
+	uint32_t primask;
+	uint8_t status;
+	
+	status = BSP_W25Qx_StartRead(ReadAddr, Size);
+	if (status != W25Qx_OK)
+	{
+		return status;
+	}
+	
+	W25Qx_StreamBuffer = pBuffer;
+	W25Qx_StreamHalfSize = HalfSize;
+	W25Qx_StreamLeft = Size;
+	W25Qx_StreamNext = 0;
+	W25Qx_StreamFill = 0;
+	W25Qx_StreamState[0] = W25Qx_HALF_FREE;
+	W25Qx_StreamState[1] = W25Qx_HALF_FREE;
+	W25Qx_DmaState = W25Qx_DMA_DONE;
+	W25Qx_StreamActive = 1;
+	
+	primask = __get_PRIMASK();
+	__disable_irq();
+	BSP_W25Qx_StreamKick();
+	__set_PRIMASK(primask);
+	
+	return W25Qx_OK;
+}
+
+/**
+  * @brief  Hands out the next half of a stream read.
+  *         The half returned by the previous call is given back to the DMA.
+  * @param  pData: Set to the data of the half
+  * @param  Size: Set to the number of bytes in the half
+  * @retval QSPI memory status
+  */
+uint8_t BSP_W25Qx_Stream_Next(uint8_t** pData, uint32_t* Size)
+{
+	uint8_t half = W25Qx_StreamNext;
+	uint32_t tickstart, primask;
+	
+	/* Release the previous half and keep the DMA going */
+	primask = __get_PRIMASK();
+	__disable_irq();
+	if (W25Qx_StreamState[half ^ 1] == W25Qx_HALF_CPU)
+	{
+		W25Qx_StreamState[half ^ 1] = W25Qx_HALF_FREE;
+	}
+	BSP_W25Qx_StreamKick();
+	__set_PRIMASK(primask);
+	
+	tickstart = HAL_GetTick();
+	LOADER_PROFILE_BEGIN(data_start);
+	while (W25Qx_StreamState[half] != W25Qx_HALF_READY)
+	{
+		if (W25Qx_DmaState == W25Qx_DMA_FAILED)
+		{
+			return W25Qx_ERROR;
+		}
+		
+		if (W25Qx_StreamState[half] == W25Qx_HALF_FREE && W25Qx_DmaState != W25Qx_DMA_BUSY)
+		{
+			/* Read past the requested size */
+			return W25Qx_ERROR;
+		}
+		
+		/* Check for the Timeout */
+		if ((HAL_GetTick() - tickstart) > W25Qx_TIMEOUT_VALUE)
+		{
+			return W25Qx_TIMEOUT;
+		}
+	}
+	
+	LOADER_PROFILE_END(LOADER_PROFILE_W25QX_DATA, data_start);
+	
+	W25Qx_StreamState[half] = W25Qx_HALF_CPU;
+	W25Qx_StreamNext = half ^ 1;
+	*pData = W25Qx_StreamBuffer + half * W25Qx_StreamHalfSize;
+	*Size = W25Qx_StreamSize[half];
+	
+	return W25Qx_OK;
+}
+
+/**
+  * @brief  Ends a stream read, aborting the transfer still running if the
+  *         caller stopped early.
+  * @retval None
+  */
+void BSP_W25Qx_Stream_Stop(void)
+{
+	uint8_t result = (W25Qx_DmaState == W25Qx_DMA_FAILED) ? W25Qx_ERROR : W25Qx_OK;
+	
+	W25Qx_StreamActive = 0;
+	
+	if (W25Qx_DmaState == W25Qx_DMA_BUSY)
+	{
+		HAL_SPI_Abort(&hspix);
+	}
+	W25Qx_DmaState = W25Qx_DMA_DONE;
+	
+	BSP_W25Qx_EndRead(result);
+}
+
+/**
+  * @brief  Starts the DMA on the next free halves of the stream buffer.
+  *         Called from the SPI callbacks, or with interrupts disabled.
+  * @retval None
+  */
+static void BSP_W25Qx_StreamKick(void)
+{
+	uint8_t half = W25Qx_StreamFill;
+	uint16_t half_size = W25Qx_StreamHalfSize;
+	uint32_t size;
+	
+	if (W25Qx_DmaState == W25Qx_DMA_BUSY || W25Qx_StreamLeft == 0 ||
+	    W25Qx_StreamState[half] != W25Qx_HALF_FREE)
+	{
+		return;
+	}
+	
+	size = (W25Qx_StreamLeft > half_size) ? half_size : W25Qx_StreamLeft;
+	W25Qx_StreamSize[half] = (uint16_t)size;
+	W25Qx_StreamState[half] = W25Qx_HALF_DMA;
+	W25Qx_StreamSpan = 1;
+	
+	/* Fill both halves at once when they are free, the half transfer
+	   callback then fires exactly at the end of the first one */
+	if (half == 0 && W25Qx_StreamLeft >= 2 * (uint32_t)half_size &&
+	    W25Qx_StreamState[1] == W25Qx_HALF_FREE)
+	{
+		W25Qx_StreamSize[1] = half_size;
+		W25Qx_StreamState[1] = W25Qx_HALF_DMA;
+		W25Qx_StreamSpan = 2;
+		size += half_size;
+	}
+	
+	W25Qx_StreamLeft -= size;
+	W25Qx_DmaState = W25Qx_DMA_BUSY;
+	if (HAL_SPI_Receive_DMA(&hspix, W25Qx_StreamBuffer + half * half_size, (uint16_t)size) != HAL_OK)
+	{
+		W25Qx_DmaState = W25Qx_DMA_FAILED;
+	}
+}
+
+/**
+  * @brief  Sends the read command of W25Qx_READ_CMD and leaves the chip
+  *         selected at W25Qx_READ_PRESCALER for the data phase.
+  * @param  ReadAddr: Read start address
+  * @param  Size: Size of the data phase, for the trace
+  * @retval QSPI memory status
+  */
+static uint8_t BSP_W25Qx_StartRead(uint32_t ReadAddr, uint32_t Size)
+{
+	uint8_t cmd[4 + W25Q80_DUMMY_BYTES_FAST_READ];
+	uint16_t cmd_size = 4;
+	uint8_t status;
+
+	status = BSP_W25Qx_WaitPending();
+	if (status != W25Qx_OK)
+	{
+		return status;
+	}
 
 	/* Configure the command */
-	cmd[0] = READ_CMD;
+	cmd[0] = W25Qx_READ_CMD;
 	cmd[1] = (uint8_t)(ReadAddr >> 16);
 	cmd[2] = (uint8_t)(ReadAddr >> 8);
 	cmd[3] = (uint8_t)(ReadAddr);
+	if (cmd[0] == FAST_READ_CMD)
+	{
+		/* Dummy byte before the data phase */
+		cmd[4] = 0x00;
+		cmd_size += W25Q80_DUMMY_BYTES_FAST_READ;
+	}
+	
+	LOADER_PROFILE_BEGIN(command_start);
+	BSP_W25Qx_SetClock(W25Qx_READ_PRESCALER);
 	
+	W25Qx_TRACE_BEGIN(cmd[0], ReadAddr, Size);
 	W25Qx_Enable();
-	/* Send the read ID command */
-	HAL_SPI_Transmit(&hspix, cmd, 4, W25Qx_TIMEOUT_VALUE);	
-	/* Reception of the data */
-	if (HAL_SPI_Receive(&hspix, pData,Size,W25Qx_TIMEOUT_VALUE) != HAL_OK)
-  	{
-    	return W25Qx_ERROR;
-  	}
-	W25Qx_Disable();
+	/* Send the read command, the data phase follows in the same CS cycle */
+	if (BSP_W25Qx_Exchange(cmd, cmd_size, NULL, 0) != W25Qx_OK)
+	{
+		BSP_W25Qx_EndRead(W25Qx_ERROR);
+		return W25Qx_ERROR;
+	}
+	LOADER_PROFILE_END(LOADER_PROFILE_W25QX_COMMAND, command_start);
+	
 	return W25Qx_OK;
 }
 
+/**
+  * @brief  Ends a read, releasing the chip select and the read clock.
+  * @param  Result: QSPI memory status of the read, for the trace
+  * @retval None
+  */
+static void BSP_W25Qx_EndRead(uint8_t Result)
+{
+	W25Qx_Disable();
+	W25Qx_TRACE_END(Result);
+	BSP_W25Qx_SetClock(W25Qx_DEFAULT_PRESCALER);
+}
+
 /**
   * @brief  Writes an amount of data to the QSPI memory.
+  *         Each page goes out as a DMA transfer (command header, then payload
+  *         chained from the Tx complete callback in the same CS cycle).
+  *         With W25Qx_WRITE_BEHIND the last page is left programming and
+  *         its completion is checked by the next command.
   * @param  pData: Pointer to data to be written
   * @param  WriteAddr: Write start address
-  * @param  Size: Size of data to write,No more than 256byte.    
+  * @param  Size: Size of data to write    
   * @retval QSPI memory status
   */
 uint8_t BSP_W25Qx_Write(uint8_t* pData, uint32_t WriteAddr, uint32_t Size)
 {
-	uint8_t cmd[4];
+	static uint8_t cmd[4];
 	uint32_t end_addr, current_size, current_addr;
-	uint32_t tickstart = HAL_GetTick();
+	uint8_t status;
 	
-	/* Calculation of the size between the write address and the end of the page */
-	current_addr = 0;
-
-	while (current_addr <= WriteAddr)
+	status = BSP_W25Qx_WaitPending();
+	if (status != W25Qx_OK)
 	{
-		current_addr += W25Q80_PAGE_SIZE;
+		return status;
 	}
-	current_size = current_addr - WriteAddr;
+	
+	/* Calculation of the size between the write address and the end of the page */
+	current_size = W25Q80_PAGE_SIZE - (WriteAddr % W25Q80_PAGE_SIZE);
 
 	/* Check if the size of the data is less than the remaining place in the page */
 	if (current_size > Size)
@@ -198,78 +628,171 @@ uint8_t BSP_W25Qx_Write(uint8_t* pData, uint32_t WriteAddr, uint32_t Size)
 		cmd[3] = (uint8_t)(current_addr);
 
 		/* Enable write operations */
-		BSP_W25Qx_WriteEnable();
-		
-		W25Qx_Enable();
-		/* Send the command */
-		if (HAL_SPI_Transmit(&hspix,cmd, 4, W25Qx_TIMEOUT_VALUE) != HAL_OK)
+		status = BSP_W25Qx_WriteEnable();
+		if (status != W25Qx_OK)
 		{
-			return W25Qx_ERROR;
+			return status;
 		}
 		
-		/* Transmission of the data */
-		if (HAL_SPI_Transmit(&hspix, pData, current_size, W25Qx_TIMEOUT_VALUE) != HAL_OK)
+		/* Send the command and the page data */
+		LOADER_PROFILE_BEGIN(data_start);
+		if (BSP_W25Qx_Transmit_DMA(cmd, 4, pData, current_size) != W25Qx_OK)
 		{
 			return W25Qx_ERROR;
 		}
 
-		W25Qx_Disable();
-		
-		/* Wait the end of Flash writing */
-		while(BSP_W25Qx_GetStatus() == W25Qx_BUSY)
+		/* Wait the end of the transfer, chip select is released by the callback */
+		status = BSP_W25Qx_WaitDMA(W25Qx_TIMEOUT_VALUE);
+		if (status != W25Qx_OK)
 		{
-			/* Check for the Timeout */
-			if((HAL_GetTick() - tickstart) > W25Qx_TIMEOUT_VALUE)
-			{        
-				return W25Qx_TIMEOUT;
-			}
+			return status;
 		}
+		LOADER_PROFILE_END(LOADER_PROFILE_W25QX_DATA, data_start);
 		
 		/* Update the address and size variables for next page programming */
 		current_addr += current_size;
 		pData += current_size;
 		current_size = ((current_addr + W25Q80_PAGE_SIZE) > end_addr) ? (end_addr - current_addr) : W25Q80_PAGE_SIZE;
+		
+#if W25Qx_WRITE_BEHIND
+		if (current_addr >= end_addr)
+		{
+			/* Leave the last page programming */
+			W25Qx_PendingTimeout = W25Qx_TIMEOUT_VALUE;
+			break;
+		}
+#endif
+		
+		/* Wait the end of Flash writing */
+		if(BSP_W25Qx_WaitForReady(W25Qx_TIMEOUT_VALUE) != W25Qx_OK)
+		{
+			return W25Qx_TIMEOUT;
+		}
 	} while (current_addr < end_addr);
 
 	return W25Qx_OK;
 }
 
 /**
-  * @brief  Erases the specified block of the QSPI memory. 
-  * @param  BlockAddress: Block address to erase  
+  * @brief  Erases the specified 4KB sector of the QSPI memory. 
+  * @param  Address: Sector address to erase  
   * @retval QSPI memory status
   */
 uint8_t BSP_W25Qx_Erase_Block(uint32_t Address)
+{
+	return BSP_W25Qx_Erase(SECTOR_ERASE_CMD, Address, W25Q80_SECTOR_ERASE_MAX_TIME);
+}
+
+/**
+  * @brief  Erases the specified 32KB block of the QSPI memory. 
+  * @param  Address: Block address to erase, 32KB aligned
+  * @retval QSPI memory status
+  */
+uint8_t BSP_W25Qx_Erase_Block32K(uint32_t Address)
+{
+	return BSP_W25Qx_Erase(BLOCK32_ERASE_CMD, Address, W25Q80_BLOCK32_ERASE_MAX_TIME);
+}
+
+/**
+  * @brief  Erases the specified 64KB block of the QSPI memory. 
+  * @param  Address: Block address to erase, 64KB aligned
+  * @retval QSPI memory status
+  */
+uint8_t BSP_W25Qx_Erase_Block64K(uint32_t Address)
+{
+	return BSP_W25Qx_Erase(BLOCK64_ERASE_CMD, Address, W25Q80_BLOCK64_ERASE_MAX_TIME);
+}
+
+/**
+  * @brief  Starts the erase of the specified 4KB sector and returns without
+  *         waiting, whatever W25Qx_ERASE_BEHIND says. The next command
+  *         waits for it.
+  * @param  Address: Sector address to erase  
+  * @retval QSPI memory status
+  */
+uint8_t BSP_W25Qx_Start_Erase_Block(uint32_t Address)
+{
+	return BSP_W25Qx_Erase_Start(SECTOR_ERASE_CMD, Address, W25Q80_SECTOR_ERASE_MAX_TIME);
+}
+
+/**
+  * @brief  Starts the erase of the specified 32KB block and returns without
+  *         waiting. The next command waits for it.
+  * @param  Address: Block address to erase, 32KB aligned
+  * @retval QSPI memory status
+  */
+uint8_t BSP_W25Qx_Start_Erase_Block32K(uint32_t Address)
+{
+	return BSP_W25Qx_Erase_Start(BLOCK32_ERASE_CMD, Address, W25Q80_BLOCK32_ERASE_MAX_TIME);
+}
+
+/**
+  * @brief  Starts the erase of the specified 64KB block and returns without
+  *         waiting. The next command waits for it.
+  * @param  Address: Block address to erase, 64KB aligned
+  * @retval QSPI memory status
+  */
+uint8_t BSP_W25Qx_Start_Erase_Block64K(uint32_t Address)
+{
+	return BSP_W25Qx_Erase_Start(BLOCK64_ERASE_CMD, Address, W25Q80_BLOCK64_ERASE_MAX_TIME);
+}
+
+/**
+  * @brief  Sends an addressed erase command and waits for its completion,
+  *         or leaves it pending with W25Qx_ERASE_BEHIND. 
+  * @param  Cmd: Erase command (sector, 32KB or 64KB block)
+  * @param  Address: Address of the area to erase
+  * @param  Timeout: Maximum erase time in ms
+  * @retval QSPI memory status
+  */
+static uint8_t BSP_W25Qx_Erase(uint8_t Cmd, uint32_t Address, uint32_t Timeout)
+{
+	uint8_t status;
+	
+	status = BSP_W25Qx_Erase_Start(Cmd, Address, Timeout);
+	if (status != W25Qx_OK)
+		return status;
+	
+#if !W25Qx_ERASE_BEHIND
+	/* Wait the end of Flash writing */
+	if(BSP_W25Qx_WaitPending() != W25Qx_OK)
+	{
+		return W25Qx_TIMEOUT;
+	}
+#endif
+	return W25Qx_OK;
+}
+
+/**
+  * @brief  Sends an addressed erase command and leaves it pending, the next
+  *         command waits for it.
+  * @param  Cmd: Erase command (sector, 32KB or 64KB block)
+  * @param  Address: Address of the area to erase
+  * @param  Timeout: Maximum erase time in ms
+  * @retval QSPI memory status
+  */
+static uint8_t BSP_W25Qx_Erase_Start(uint8_t Cmd, uint32_t Address, uint32_t Timeout)
 {
 	uint8_t cmd[4];
-	uint32_t tickstart = HAL_GetTick();
-	cmd[0] = SECTOR_ERASE_CMD;
+	if (BSP_W25Qx_WaitPending() != W25Qx_OK)
+		return W25Qx_TIMEOUT;
+	
+	cmd[0] = Cmd;
 	cmd[1] = (uint8_t)(Address >> 16);
 	cmd[2] = (uint8_t)(Address >> 8);
 	cmd[3] = (uint8_t)(Address);
 	
 	/* Enable write operations */
-	BSP_W25Qx_WriteEnable();
-	
-	/*Select the FLASH: Chip Select low */
-	W25Qx_Enable();
-	
-	/* Send the read ID command */
-	if(HAL_SPI_Transmit(&hspix, cmd, 4, W25Qx_TIMEOUT_VALUE) != HAL_OK)	
+	if (BSP_W25Qx_WriteEnable() != W25Qx_OK)
 		return W25Qx_ERROR;
 	
-	/*Deselect the FLASH: Chip Select high */
-	W25Qx_Disable();
+	/* Send the erase command */
+	LOADER_PROFILE_BEGIN(command_start);
+	if (BSP_W25Qx_Command(cmd, 4, NULL, 0) != W25Qx_OK)
+		return W25Qx_ERROR;
+	LOADER_PROFILE_END(LOADER_PROFILE_W25QX_COMMAND, command_start);
 	
-	/* Wait the end of Flash writing */
-	while(BSP_W25Qx_GetStatus() == W25Qx_BUSY)
-	{
-		/* Check for the Timeout */
-		if((HAL_GetTick() - tickstart) > W25Q80_SECTOR_ERASE_MAX_TIME)
-		{        
-			return W25Qx_TIMEOUT;
-		}
-	}
+	W25Qx_PendingTimeout = Timeout;
 	return W25Qx_OK;
 }
 
@@ -280,33 +803,317 @@ uint8_t BSP_W25Qx_Erase_Block(uint32_t Address)
 uint8_t BSP_W25Qx_Erase_Chip(void)
 {
 	uint8_t cmd[4];
-	uint32_t tickstart = HAL_GetTick();
+	if (BSP_W25Qx_WaitPending() != W25Qx_OK)
+		return W25Qx_TIMEOUT;
+	
 	cmd[0] = CHIP_ERASE_CMD;
 	
 	/* Enable write operations */
-	BSP_W25Qx_WriteEnable();
+	if (BSP_W25Qx_WriteEnable() != W25Qx_OK)
+		return W25Qx_ERROR;
 	
-	/*Select the FLASH: Chip Select low */
-	W25Qx_Enable();
+	/* Send the chip erase command */
+	LOADER_PROFILE_BEGIN(command_start);
+	if (BSP_W25Qx_Command(cmd, 1, NULL, 0) != W25Qx_OK)
+		return W25Qx_ERROR;
+	LOADER_PROFILE_END(LOADER_PROFILE_W25QX_COMMAND, command_start);
+	
+	/* Wait the end of Flash writing */
+	if(BSP_W25Qx_WaitForReady(W25Q80_BULK_ERASE_MAX_TIME) != W25Qx_OK)
+	{
+		return W25Qx_TIMEOUT;
+	}
+	
+	return W25Qx_OK;
+}
+
+/**
+  * @brief  Changes the SPI clock prescaler between transfers.
+  *         SPE is cleared to update BR, the next transfer enables it again.
+  * @param  Prescaler: SPI_BAUDRATEPRESCALER_x value
+  * @retval None
+  */
+static void BSP_W25Qx_SetClock(uint32_t Prescaler)
+{
+	if ((hspix.Instance->CR1 & SPI_CR1_BR) != Prescaler)
+	{
+		__HAL_SPI_DISABLE(&hspix);
+		MODIFY_REG(hspix.Instance->CR1, SPI_CR1_BR, Prescaler);
+		hspix.Init.BaudRatePrescaler = Prescaler;
+	}
+}
 
-	/* Send the read ID command */
-	if(HAL_SPI_Transmit(&hspix, cmd, 1, W25Qx_TIMEOUT_VALUE) != HAL_OK)	
+/**
+  * @brief  Sends a command and clocks in its response in one full duplex
+  *         transfer, the chip being selected. There is no gap on the bus
+  *         between the two phases.
+  *         With W25Qx_DIRECT_SPI it runs on the register layer of
+  *         W25Qx_SPI.h, otherwise on a blocking HAL_SPI_TransmitReceive.
+  * @param  pCmd: Pointer to the command bytes, NULL if CmdSize is 0
+  * @param  CmdSize: Number of command bytes
+  * @param  pData: Pointer to the received bytes, NULL if Size is 0
+  * @param  Size: Number of bytes received after the command
+  * @retval QSPI memory status
+  */
+static uint8_t BSP_W25Qx_Exchange(uint8_t *pCmd, uint16_t CmdSize, uint8_t *pData, uint16_t Size)
+{
+#if W25Qx_DIRECT_SPI
+	return W25Qx_SPI_Transaction(hspix.Instance, pCmd, CmdSize, pData, Size);
+#else
+	uint8_t buffer[W25Qx_EXCHANGE_SIZE];
+	uint16_t i;
+	
+	if (CmdSize + Size > W25Qx_EXCHANGE_SIZE)
+	{
 		return W25Qx_ERROR;
+	}
 	
-	/*Deselect the FLASH: Chip Select high */
+	for (i = 0; i < CmdSize + Size; i++)
+	{
+		buffer[i] = (i < CmdSize) ? pCmd[i] : 0xFF;
+	}
+	if (HAL_SPI_TransmitReceive(&hspix, buffer, buffer, CmdSize + Size, W25Qx_TIMEOUT_VALUE) != HAL_OK)
+	{
+		return W25Qx_ERROR;
+	}
+	for (i = 0; i < Size; i++)
+	{
+		pData[i] = buffer[CmdSize + i];
+	}
+	return W25Qx_OK;
+#endif
+}
+
+/**
+  * @brief  Runs a command in its own chip select cycle, see BSP_W25Qx_Exchange.
+  * @param  pCmd: Pointer to the command bytes, opcode first
+  * @param  CmdSize: Number of command bytes
+  * @param  pData: Pointer to the received bytes, NULL if Size is 0
+  * @param  Size: Number of bytes received after the command
+  * @retval QSPI memory status
+  */
+static uint8_t BSP_W25Qx_Command(uint8_t *pCmd, uint16_t CmdSize, uint8_t *pData, uint16_t Size)
+{
+	uint8_t status;
+	
+	W25Qx_TRACE_BEGIN(pCmd[0], (CmdSize >= 4) ? ((uint32_t)pCmd[1] << 16) | ((uint32_t)pCmd[2] << 8) | pCmd[3] : 0, Size);
+	W25Qx_Enable();
+	status = BSP_W25Qx_Exchange(pCmd, CmdSize, pData, Size);
 	W25Qx_Disable();
+	W25Qx_TRACE_END(status);
 	
-	/* Wait the end of Flash writing */
-	while(BSP_W25Qx_GetStatus() == W25Qx_BUSY)
+	return status;
+}
+
+/**
+  * @brief  Starts a DMA transfer of a command header followed by its data.
+  *         The chip select is asserted here and released by the Tx complete
+  *         callback once the data phase is on the wire.
+  * @param  pCmd: Pointer to the command header, must stay valid until done
+  * @param  CmdSize: Size of the command header
+  * @param  pData: Pointer to the data sent in the same CS cycle
+  * @param  Size: Size of the data, 0 for a command only transfer
+  * @retval QSPI memory status
+  */
+static uint8_t BSP_W25Qx_Transmit_DMA(uint8_t *pCmd, uint16_t CmdSize, uint8_t *pData, uint16_t Size)
+{
+	W25Qx_DmaData = pData;
+	W25Qx_DmaDataSize = Size;
+	W25Qx_DmaState = W25Qx_DMA_BUSY;
+	
+	W25Qx_TRACE_BEGIN(pCmd[0], (CmdSize >= 4) ? ((uint32_t)pCmd[1] << 16) | ((uint32_t)pCmd[2] << 8) | pCmd[3] : 0, Size);
+	W25Qx_Enable();
+	if (HAL_SPI_Transmit_DMA(&hspix, pCmd, CmdSize) != HAL_OK)
+	{
+		W25Qx_Disable();
+		W25Qx_TRACE_END(W25Qx_ERROR);
+		W25Qx_DmaState = W25Qx_DMA_DONE;
+		return W25Qx_ERROR;
+	}
+	
+	return W25Qx_OK;
+}
+
+/**
+  * @brief  Waits for the pending DMA transfer.
+  * @param  Timeout: Timeout in ms
+  * @retval QSPI memory status
+  */
+static uint8_t BSP_W25Qx_WaitDMA(uint32_t Timeout)
+{
+	uint32_t tickstart = HAL_GetTick();
+	
+	while (W25Qx_DmaState == W25Qx_DMA_BUSY)
 	{
 		/* Check for the Timeout */
-		if((HAL_GetTick() - tickstart) > W25Q80_BULK_ERASE_MAX_TIME)
-		{        
+		if ((HAL_GetTick() - tickstart) > Timeout)
+		{
+			HAL_SPI_Abort(&hspix);
+			W25Qx_Disable();
+			W25Qx_TRACE_END(W25Qx_TIMEOUT);
+			W25Qx_DmaState = W25Qx_DMA_DONE;
 			return W25Qx_TIMEOUT;
 		}
 	}
 	
+	if (W25Qx_DmaState == W25Qx_DMA_FAILED)
+	{
+		W25Qx_DmaState = W25Qx_DMA_DONE;
+		return W25Qx_ERROR;
+	}
+	
 	return W25Qx_OK;
 }
 
+/**
+  * @brief  Tx Transfer completed callback.
+  *         Chains the data phase after the command header, then releases
+  *         the chip select once the whole transfer is done.
+  * @param  hspi: SPI handle
+  * @retval None
+  */
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	uint16_t size = W25Qx_DmaDataSize;
+	
+	if (hspi->Instance != hspix.Instance)
+	{
+		return;
+	}
+	
+	if (size != 0)
+	{
+		/* Keep the chip selected and send the data phase */
+		W25Qx_DmaDataSize = 0;
+		if (HAL_SPI_Transmit_DMA(hspi, W25Qx_DmaData, size) == HAL_OK)
+		{
+			return;
+		}
+		W25Qx_DmaState = W25Qx_DMA_FAILED;
+	}
+	else
+	{
+		W25Qx_DmaState = W25Qx_DMA_DONE;
+	}
+	
+	W25Qx_Disable();
+	W25Qx_TRACE_END((W25Qx_DmaState == W25Qx_DMA_DONE) ? W25Qx_OK : W25Qx_ERROR);
+}
+
+/**
+  * @brief  Rx Transfer completed callback.
+  *         The chip select is left asserted, the reader releases it after
+  *         the last chunk.
+  * @param  hspi: SPI handle
+  * @retval None
+  */
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	uint8_t half = W25Qx_StreamFill;
+	
+	if (hspi->Instance != hspix.Instance)
+	{
+		return;
+	}
+	
+	W25Qx_DmaState = W25Qx_DMA_DONE;
+	
+	if (W25Qx_StreamActive)
+	{
+		/* Hand the received halves out and refill the next free one. The
+		   first half of a two half transfer went out from the half transfer
+		   callback and may already be back with the caller */
+		if (W25Qx_StreamSpan == 2)
+		{
+			if (W25Qx_StreamState[0] == W25Qx_HALF_DMA)
+			{
+				W25Qx_StreamState[0] = W25Qx_HALF_READY;
+			}
+			W25Qx_StreamState[1] = W25Qx_HALF_READY;
+		}
+		else
+		{
+			W25Qx_StreamState[half] = W25Qx_HALF_READY;
+			W25Qx_StreamFill = half ^ 1;
+		}
+		BSP_W25Qx_StreamKick();
+	}
+}
+
+/**
+  * @brief  Rx Half Transfer callback.
+  *         When a stream transfer spans both halves, the first one is ready.
+  * @param  hspi: SPI handle
+  * @retval None
+  */
+void HAL_SPI_RxHalfCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if (hspi->Instance != hspix.Instance)
+	{
+		return;
+	}
+	
+	if (W25Qx_StreamActive && W25Qx_StreamSpan == 2)
+	{
+		W25Qx_StreamState[0] = W25Qx_HALF_READY;
+	}
+}
+
+/**
+  * @brief  SPI error callback.
+  * @param  hspi: SPI handle
+  * @retval None
+  */
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+	if (hspi->Instance != hspix.Instance)
+	{
+		return;
+	}
+	
+	W25Qx_DmaDataSize = 0;
+	W25Qx_DmaState = W25Qx_DMA_FAILED;
+	W25Qx_Disable();
+	W25Qx_TRACE_END(W25Qx_ERROR);
+}
 
+#if W25Qx_TRACE
+/**
+  * @brief  Opens the trace record of a chip select cycle.
+  * @param  Opcode: Command sent first
+  * @param  Address: 24-bit address of the command, 0 if none
+  * @param  Length: Size of the data phase
+  * @retval None
+  */
+static void BSP_W25Qx_TraceBegin(uint8_t Opcode, uint32_t Address, uint32_t Length)
+{
+	W25Qx_TraceRecordTypeDef *record = &W25Qx_Trace.Record[W25Qx_Trace.Count & (W25Qx_TRACE_DEPTH - 1)];
+	
+	record->Command = ((uint32_t)Opcode << 24) | (Address & 0x00FFFFFF);
+	record->Length = Length & 0x00FFFFFF;
+	W25Qx_TraceOpen = 1;
+	record->Start = DWT->CYCCNT;
+}
+
+/**
+  * @brief  Closes the open trace record, the first call after the chip is
+  *         deselected counts.
+  * @param  Result: QSPI memory status of the cycle
+  * @retval None
+  */
+static void BSP_W25Qx_TraceEnd(uint8_t Result)
+{
+	uint32_t end = DWT->CYCCNT;
+	W25Qx_TraceRecordTypeDef *record = &W25Qx_Trace.Record[W25Qx_Trace.Count & (W25Qx_TRACE_DEPTH - 1)];
+	
+	if (!W25Qx_TraceOpen)
+	{
+		return;
+	}
+	
+	W25Qx_TraceOpen = 0;
+	record->End = end;
+	record->Length |= (uint32_t)Result << 24;
+	W25Qx_Trace.Count++;
+}
+#endif
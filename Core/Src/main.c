@@ -122,6 +122,9 @@ int main(void)
 	}
 
 	Verify(0, 0, 1, 0);
+#if LOADER_CRC32
+	Crc32(0, BUFFER_SIZE, 0);
+#endif
   
   /* Infinite loop */
   while (1)
@@ -0,0 +1,63 @@
+/**
+  ******************************************************************************
+  * @file    W25Q80_Sim.h
+  * @brief   Behavioral model of the W25Q80 SPI NOR flash for host builds.
+  *          Decodes the command set of W25QXX.h one byte at a time between
+  *          chip select edges, with NOR semantics (programming only clears
+  *          bits, page wrap, WEL, BUSY) and datasheet typical timings on a
+  *          virtual clock.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __W25Q80_SIM_H
+#define __W25Q80_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "W25QXX.h"
+
+/* Typical timings of the W25Q80DV datasheet, in ns */
+#define W25Q80_SIM_PAGE_PROG_NS            700000ULL      /* tPP */
+#define W25Q80_SIM_SECTOR_ERASE_NS         45000000ULL    /* tSE */
+#define W25Q80_SIM_BLOCK32_ERASE_NS        120000000ULL   /* tBE1 */
+#define W25Q80_SIM_BLOCK64_ERASE_NS        150000000ULL   /* tBE2 */
+#define W25Q80_SIM_CHIP_ERASE_NS           2000000000ULL  /* tCE */
+
+/* Manufacturer and device ID returned by READ_ID_CMD */
+#define W25Q80_SIM_MANUFACTURER_ID         0xEF
+#define W25Q80_SIM_DEVICE_ID               0x13
+
+/* Activity seen on the bus since the last W25Q80_Sim_Reset */
+typedef struct
+{
+  uint64_t Transactions;        /* chip select cycles */
+  uint64_t BytesOnWire;         /* bytes clocked while selected */
+  uint64_t BusyPolls;           /* status bytes read while BUSY */
+  uint64_t BusyTimeNs;          /* time spent programming or erasing */
+  uint32_t PagePrograms;
+  uint32_t SectorErases;
+  uint32_t Block32Erases;
+  uint32_t Block64Erases;
+  uint32_t ChipErases;
+  uint32_t IgnoredCommands;     /* sent while BUSY, without WEL or malformed */
+} W25Q80_SimStatsTypeDef;
+
+void W25Q80_Sim_Reset(uint8_t Fill);
+void W25Q80_Sim_Select(void);
+void W25Q80_Sim_Deselect(void);
+uint8_t W25Q80_Sim_Transfer(uint8_t Mosi);
+void W25Q80_Sim_Advance(uint64_t Ns);
+uint64_t W25Q80_Sim_Now(void);
+uint8_t *W25Q80_Sim_Memory(void);
+W25Q80_SimStatsTypeDef *W25Q80_Sim_Stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __W25Q80_SIM_H */
@@ -0,0 +1,71 @@
+/**
+  ******************************************************************************
+  * @file    hal_host.h
+  * @brief   Timing model of the host HAL stand-in. SPI bytes take the time
+  *          of the SPI3 clock selected in CR1 (APB1 36MHz / prescaler) and
+  *          every HAL call adds a fixed software overhead, as does each
+  *          register access of W25Qx_SPI.h, all on the virtual clock of
+  *          the W25Q80 simulator.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __HAL_HOST_H
+#define __HAL_HOST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f3xx_hal.h"
+
+/* CPU clock of the DWT cycle counter and SPI3 kernel clock */
+#define HAL_HOST_HCLK_HZ                   72000000U
+#define HAL_HOST_APB1_HZ                   36000000U
+
+/* Default software cost of the HAL calls, in ns at 72MHz */
+#define HAL_HOST_SPI_CALL_NS               2000U   /* blocking transfer setup and teardown */
+#define HAL_HOST_DMA_CALL_NS               3000U   /* DMA transfer setup and completion IRQ */
+#define HAL_HOST_GPIO_CALL_NS              100U    /* chip select write */
+
+/* Software cost of the register layer of W25Qx_SPI.h, in ns at 72MHz */
+#define HAL_HOST_REG_ACCESS_NS             30U     /* SR, DR or BSRR access and its share
+                                                      of the polling loop */
+
+/* DMA completion model. With HAL_HOST_DMA_DEFERRED clear a DMA transfer
+   is on the wire before its start call returns and its callbacks are
+   called from it. When set, the start call only records the transfer:
+   its bytes move and its callbacks run from the poll points of the CPU,
+   HAL_GetTick and the clearing of PRIMASK, once its wire time and a
+   random interrupt latency have elapsed. Each poll point also advances
+   the clock by a random CPU time, so the half and complete callbacks land
+   at any point of the polling loops of the driver. */
+#ifndef HAL_HOST_DMA_DEFERRED
+#define HAL_HOST_DMA_DEFERRED              0
+#endif
+#ifndef HAL_HOST_DMA_JITTER_NS
+#define HAL_HOST_DMA_JITTER_NS             200000U /* bound of the latency and of the
+                                                      CPU time between poll points */
+#endif
+
+/* Overheads in use, may be changed between runs */
+extern uint32_t HalHost_SpiCallNs;
+extern uint32_t HalHost_DmaCallNs;
+extern uint32_t HalHost_GpioCallNs;
+extern uint32_t HalHost_RegAccessNs;
+
+/* Random state of the deferred DMA model, may be seeded between runs */
+extern uint32_t HalHost_DmaSeed;
+
+/* Fault injection: MISO pulled high, every byte received reads 0xFF */
+extern uint8_t HalHost_MisoStuckHigh;
+
+/* Fault injection: SPI3 stalled, SR reads 0 and no byte moves */
+extern uint8_t HalHost_SpiStalled;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HAL_HOST_H */
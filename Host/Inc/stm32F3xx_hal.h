@@ -0,0 +1,7 @@
+/**
+  ******************************************************************************
+  * @file    stm32F3xx_hal.h
+  * @brief   Host stand-in, everything lives in stm32f3xx_hal.h
+  ******************************************************************************
+  */
+#include "stm32f3xx_hal.h"
@@ -0,0 +1,7 @@
+/**
+  ******************************************************************************
+  * @file    stm32f3xx.h
+  * @brief   Host stand-in, everything lives in stm32f3xx_hal.h
+  ******************************************************************************
+  */
+#include "stm32f3xx_hal.h"
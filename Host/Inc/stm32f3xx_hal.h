@@ -0,0 +1,192 @@
+/**
+  ******************************************************************************
+  * @file    stm32f3xx_hal.h
+  * @brief   Host stand-in for the STM32F3 HAL. Declares only what W25QXX.c
+  *          and Loader_Src.c use, the SPI, GPIO and tick calls are
+  *          implemented by hal_host.c on top of the W25Q80 simulator.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __STM32F3xx_HAL_H
+#define __STM32F3xx_HAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+
+#define __IO volatile
+
+typedef enum
+{
+  HAL_OK       = 0x00U,
+  HAL_ERROR    = 0x01U,
+  HAL_BUSY     = 0x02U,
+  HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+/* Core registers touched by Init --------------------------------------------*/
+typedef struct
+{
+  __IO uint32_t VTOR;
+} SCB_Type;
+
+typedef struct
+{
+  __IO uint32_t DHCSR;
+  __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+/* CYCCNT follows the simulator clock at HAL_HOST_HCLK_HZ */
+typedef struct
+{
+  __IO uint32_t CTRL;
+  __IO uint32_t CYCCNT;
+} DWT_Type;
+
+extern SCB_Type HostSCB;
+extern CoreDebug_Type HostCoreDebug;
+extern DWT_Type HostDWT;
+
+#define SCB                 (&HostSCB)
+#define CoreDebug           (&HostCoreDebug)
+#define DWT                 (&HostDWT)
+
+#define CoreDebug_DEMCR_TRCENA_Msk      (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk          (1UL << 0)
+
+/* Interrupt mask of hal_host.c, the DMA callbacks it holds back are
+   delivered when the mask is cleared */
+extern uint32_t HalHost_Primask;
+void HalHost_DmaPoll(void);
+
+static inline void __set_PRIMASK(uint32_t priMask)
+{
+  HalHost_Primask = priMask & 1U;
+  HalHost_DmaPoll();
+}
+static inline uint32_t __get_PRIMASK(void) { return HalHost_Primask; }
+static inline void __disable_irq(void) { HalHost_Primask = 1U; }
+static inline void __enable_irq(void) { __set_PRIMASK(0); }
+
+/* Cortex-M4 DSP instruction: sum of the absolute differences of the four
+   bytes of op1 and op2, added to op3 */
+static inline uint32_t __USADA8(uint32_t op1, uint32_t op2, uint32_t op3)
+{
+  uint32_t i, a, b;
+
+  for (i = 0; i < 32; i += 8)
+  {
+    a = (op1 >> i) & 0xFF;
+    b = (op2 >> i) & 0xFF;
+    op3 += (a > b) ? a - b : b - a;
+  }
+  return op3;
+}
+
+/* Register access -----------------------------------------------------------*/
+#define SET_BIT(REG, BIT)     ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT)   ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT)    ((REG) & (BIT))
+#define MODIFY_REG(REG, CLEARMASK, SETMASK)  ((REG) = (((REG) & (~(CLEARMASK))) | (SETMASK)))
+
+/* GPIO ----------------------------------------------------------------------*/
+typedef struct
+{
+  __IO uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef enum
+{
+  GPIO_PIN_RESET = 0U,
+  GPIO_PIN_SET
+} GPIO_PinState;
+
+extern GPIO_TypeDef HostGPIOD;
+
+#define GPIOD               (&HostGPIOD)
+#define GPIO_PIN_2          ((uint16_t)0x0004)
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+
+/* SPI -----------------------------------------------------------------------*/
+typedef struct
+{
+  __IO uint32_t CR1;
+  __IO uint32_t CR2;
+  __IO uint32_t SR;
+  __IO uint32_t DR;
+} SPI_TypeDef;
+
+typedef struct
+{
+  uint32_t BaudRatePrescaler;
+} SPI_InitTypeDef;
+
+typedef struct __SPI_HandleTypeDef
+{
+  SPI_TypeDef     *Instance;
+  SPI_InitTypeDef Init;
+} SPI_HandleTypeDef;
+
+#define SPI_CR1_BR                      (0x7U << 3)
+#define SPI_CR1_SPE                     (0x1U << 6)
+#define SPI_CR2_FRXTH                   (0x1U << 12)
+#define SPI_SR_RXNE                     (0x1U << 0)
+#define SPI_SR_TXE                      (0x1U << 1)
+
+#define SPI_BAUDRATEPRESCALER_2         (0x00000000U)
+#define SPI_BAUDRATEPRESCALER_4         (0x00000008U)
+#define SPI_BAUDRATEPRESCALER_8         (0x00000010U)
+#define SPI_BAUDRATEPRESCALER_16        (0x00000018U)
+#define SPI_BAUDRATEPRESCALER_32        (0x00000020U)
+#define SPI_BAUDRATEPRESCALER_64        (0x00000028U)
+#define SPI_BAUDRATEPRESCALER_128       (0x00000030U)
+#define SPI_BAUDRATEPRESCALER_256       (0x00000038U)
+
+#define __HAL_SPI_DISABLE(__HANDLE__)   CLEAR_BIT((__HANDLE__)->Instance->CR1, SPI_CR1_SPE)
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_RxHalfCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+
+/* SR, DR and the GPIOD BSRR are modeled by hal_host.c, the register layer
+   of W25Qx_SPI.h reaches them through these */
+uint32_t HalHost_ReadSR(SPI_TypeDef *SPIx);
+uint8_t HalHost_ReadDR(SPI_TypeDef *SPIx);
+void HalHost_WriteDR(SPI_TypeDef *SPIx, uint8_t Data);
+void HalHost_WriteBSRR(GPIO_TypeDef *GPIOx, uint32_t Value);
+
+#define W25Qx_SPI_READ_SR(SPIx)            HalHost_ReadSR(SPIx)
+#define W25Qx_SPI_READ_DR(SPIx)            HalHost_ReadDR(SPIx)
+#define W25Qx_SPI_WRITE_DR(SPIx, Data)     HalHost_WriteDR((SPIx), (Data))
+#define W25Qx_SPI_WRITE_BSRR(GPIOx, Value) HalHost_WriteBSRR((GPIOx), (Value))
+
+/* RCC -----------------------------------------------------------------------*/
+#define __HAL_RCC_SPI3_FORCE_RESET()    do { } while (0)
+#define __HAL_RCC_SPI3_RELEASE_RESET()  do { } while (0)
+
+/* System --------------------------------------------------------------------*/
+extern uint32_t SystemCoreClock;
+
+void SystemInit(void);
+HAL_StatusTypeDef HAL_Init(void);
+uint32_t HAL_GetTick(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32F3xx_HAL_H */
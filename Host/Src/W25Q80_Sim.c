@@ -0,0 +1,428 @@
+/**
+  ******************************************************************************
+  * @file    W25Q80_Sim.c
+  * @brief   Behavioral model of the W25Q80 SPI NOR flash for host builds.
+  *          A transaction is the bytes exchanged between W25Q80_Sim_Select
+  *          and W25Q80_Sim_Deselect. Read commands answer byte per byte,
+  *          write enable, program and erase commands take effect when the
+  *          chip is deselected, as on the real part.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "W25Q80_Sim.h"
+#include <string.h>
+
+#define SIM_ADDRESS_MASK   (MEMORY_FLASH_SIZE - 1)
+
+static uint8_t SimMemory[MEMORY_FLASH_SIZE];
+static W25Q80_SimStatsTypeDef SimStats;
+
+static uint64_t SimNow;
+static uint64_t SimBusyUntil;
+
+static uint8_t SimSelected;
+static uint8_t SimWel;
+static uint8_t SimWelClearsWhenReady;
+static uint8_t SimResetEnabled;
+
+/* Current transaction */
+static uint8_t SimCmd;
+static uint8_t SimCmdIgnored;
+static uint32_t SimCount;
+static uint32_t SimAddress;
+static uint32_t SimPageBytes;
+static uint8_t SimPage[MEMORY_PAGE_SIZE];
+
+static uint8_t W25Q80_Sim_IsBusy(void);
+static uint8_t W25Q80_Sim_Status(void);
+static void W25Q80_Sim_StartBusy(uint64_t Ns);
+static void W25Q80_Sim_Erase(uint32_t Size, uint64_t Ns, uint32_t *Counter);
+static void W25Q80_Sim_Execute(void);
+
+/**
+  * @brief  Powers the model up: memory filled, status clear, clock and
+  *         statistics at zero.
+  * @param  Fill: Initial content of every byte
+  * @retval None
+  */
+void W25Q80_Sim_Reset(uint8_t Fill)
+{
+  memset(SimMemory, Fill, sizeof(SimMemory));
+  memset(&SimStats, 0, sizeof(SimStats));
+  SimNow = 0;
+  SimBusyUntil = 0;
+  SimSelected = 0;
+  SimWel = 0;
+  SimWelClearsWhenReady = 0;
+  SimResetEnabled = 0;
+}
+
+/**
+  * @brief  Chip select falling edge, starts a transaction.
+  * @retval None
+  */
+void W25Q80_Sim_Select(void)
+{
+  if (SimSelected)
+  {
+    return;
+  }
+
+  SimSelected = 1;
+  SimCount = 0;
+  SimCmdIgnored = 0;
+  SimStats.Transactions++;
+}
+
+/**
+  * @brief  Chip select rising edge, executes the write enable, program and
+  *         erase commands of the transaction.
+  * @retval None
+  */
+void W25Q80_Sim_Deselect(void)
+{
+  if (!SimSelected)
+  {
+    return;
+  }
+
+  SimSelected = 0;
+  if (SimCount == 0 || SimCmdIgnored)
+  {
+    return;
+  }
+
+  W25Q80_Sim_Execute();
+}
+
+/**
+  * @brief  Exchanges one byte with the chip.
+  * @param  Mosi: Byte sent by the host
+  * @retval Byte returned by the chip, 0xFF when it does not drive MISO
+  */
+uint8_t W25Q80_Sim_Transfer(uint8_t Mosi)
+{
+  uint32_t index;
+
+  if (!SimSelected)
+  {
+    return 0xFF;
+  }
+
+  SimStats.BytesOnWire++;
+  index = SimCount++;
+
+  if (index == 0)
+  {
+    SimCmd = Mosi;
+    SimAddress = 0;
+    SimPageBytes = 0;
+    memset(SimPage, MEMORY_ERASE_VALUE, sizeof(SimPage));
+
+    /* Only the status registers can be read while BUSY */
+    if (W25Q80_Sim_IsBusy() && Mosi != READ_STATUS_REG1_CMD &&
+        Mosi != READ_STATUS_REG2_CMD && Mosi != READ_STATUS_REG3_CMD)
+    {
+      SimCmdIgnored = 1;
+      SimStats.IgnoredCommands++;
+    }
+    return 0xFF;
+  }
+
+  if (SimCmdIgnored)
+  {
+    return 0xFF;
+  }
+
+  /* 24-bit address following the opcode */
+  if (index <= 3)
+  {
+    switch (SimCmd)
+    {
+      case READ_CMD:
+      case FAST_READ_CMD:
+      case READ_ID_CMD:
+      case PAGE_PROG_CMD:
+      case SECTOR_ERASE_CMD:
+      case BLOCK32_ERASE_CMD:
+      case BLOCK64_ERASE_CMD:
+        SimAddress = ((SimAddress << 8) | Mosi) & 0xFFFFFF;
+        return 0xFF;
+      default:
+        break;
+    }
+  }
+
+  switch (SimCmd)
+  {
+    case READ_STATUS_REG1_CMD:
+      /* The register is repeated until the chip is deselected */
+      if (W25Q80_Sim_IsBusy())
+      {
+        SimStats.BusyPolls++;
+      }
+      return W25Q80_Sim_Status();
+
+    case READ_STATUS_REG2_CMD:
+    case READ_STATUS_REG3_CMD:
+      return 0x00;
+
+    case READ_CMD:
+      return SimMemory[SimAddress++ & SIM_ADDRESS_MASK];
+
+    case FAST_READ_CMD:
+      /* One dummy byte after the address */
+      if (index == 4)
+      {
+        return 0xFF;
+      }
+      return SimMemory[SimAddress++ & SIM_ADDRESS_MASK];
+
+    case READ_ID_CMD:
+      /* Address 0 starts with the manufacturer ID, 1 with the device ID */
+      return (((index - 4) + (SimAddress & 1)) % 2 == 0) ? W25Q80_SIM_MANUFACTURER_ID : W25Q80_SIM_DEVICE_ID;
+
+    case READ_JEDEC_ID_CMD:
+      switch ((index - 1) % 3)
+      {
+        case 0:  return W25Q80_SIM_MANUFACTURER_ID;
+        case 1:  return 0x40;
+        default: return 0x14;
+      }
+
+    case PAGE_PROG_CMD:
+      /* Data past the end of the page wraps to its start */
+      SimPage[(SimAddress + SimPageBytes) % MEMORY_PAGE_SIZE] = Mosi;
+      SimPageBytes++;
+      return 0xFF;
+
+    default:
+      return 0xFF;
+  }
+}
+
+/**
+  * @brief  Moves the virtual clock forward.
+  * @param  Ns: Elapsed time in ns
+  * @retval None
+  */
+void W25Q80_Sim_Advance(uint64_t Ns)
+{
+  SimNow += Ns;
+}
+
+/**
+  * @brief  Current time of the virtual clock.
+  * @retval Time in ns since W25Q80_Sim_Reset
+  */
+uint64_t W25Q80_Sim_Now(void)
+{
+  return SimNow;
+}
+
+/**
+  * @brief  Memory array of the model, for preloading and checking content.
+  * @retval Pointer to MEMORY_FLASH_SIZE bytes
+  */
+uint8_t *W25Q80_Sim_Memory(void)
+{
+  return SimMemory;
+}
+
+/**
+  * @brief  Bus activity since the last W25Q80_Sim_Reset, may be cleared
+  *         by the caller.
+  * @retval Pointer to the statistics
+  */
+W25Q80_SimStatsTypeDef *W25Q80_Sim_Stats(void)
+{
+  return &SimStats;
+}
+
+/**
+  * @brief  Tells whether a program or erase is in progress, WEL is cleared
+  *         once it completes.
+  * @retval 1 when BUSY
+  */
+static uint8_t W25Q80_Sim_IsBusy(void)
+{
+  if (SimNow < SimBusyUntil)
+  {
+    return 1;
+  }
+
+  if (SimWelClearsWhenReady)
+  {
+    SimWelClearsWhenReady = 0;
+    SimWel = 0;
+  }
+  return 0;
+}
+
+/**
+  * @brief  Value of status register 1.
+  * @retval BUSY and WEL bits
+  */
+static uint8_t W25Q80_Sim_Status(void)
+{
+  uint8_t status = 0;
+
+  if (W25Q80_Sim_IsBusy())
+  {
+    status |= W25Q80_FSR_BUSY;
+  }
+  if (SimWel)
+  {
+    status |= W25Q80_FSR_WREN;
+  }
+  return status;
+}
+
+/**
+  * @brief  Starts a program or erase lasting Ns.
+  * @param  Ns: Duration in ns
+  * @retval None
+  */
+static void W25Q80_Sim_StartBusy(uint64_t Ns)
+{
+  SimBusyUntil = SimNow + Ns;
+  SimWelClearsWhenReady = 1;
+  SimStats.BusyTimeNs += Ns;
+}
+
+/**
+  * @brief  Erases the aligned area around the transaction address.
+  * @param  Size: Area size, a power of 2
+  * @param  Ns: Erase time in ns
+  * @param  Counter: Statistics counter of the command
+  * @retval None
+  */
+static void W25Q80_Sim_Erase(uint32_t Size, uint64_t Ns, uint32_t *Counter)
+{
+  uint32_t address = SimAddress & SIM_ADDRESS_MASK & ~(Size - 1);
+
+  memset(&SimMemory[address], MEMORY_ERASE_VALUE, Size);
+  W25Q80_Sim_StartBusy(Ns);
+  (*Counter)++;
+}
+
+/**
+  * @brief  Executes the command of the transaction that just ended.
+  * @retval None
+  */
+static void W25Q80_Sim_Execute(void)
+{
+  uint32_t page, i;
+  uint8_t reset_enabled = SimResetEnabled;
+
+  SimResetEnabled = 0;
+
+  switch (SimCmd)
+  {
+    case WRITE_ENABLE_CMD:
+      if (SimCount == 1)
+      {
+        SimWel = 1;
+      }
+      return;
+
+    case WRITE_DISABLE_CMD:
+      if (SimCount == 1)
+      {
+        SimWel = 0;
+      }
+      return;
+
+    case RESET_ENABLE_CMD:
+      /* The reset must follow in its own transaction */
+      if (SimCount == 1)
+      {
+        SimResetEnabled = 1;
+      }
+      else
+      {
+        SimStats.IgnoredCommands++;
+      }
+      return;
+
+    case RESET_MEMORY_CMD:
+      if (SimCount == 1 && reset_enabled)
+      {
+        SimWel = 0;
+      }
+      else
+      {
+        SimStats.IgnoredCommands++;
+      }
+      return;
+
+    case PAGE_PROG_CMD:
+    case SECTOR_ERASE_CMD:
+    case BLOCK32_ERASE_CMD:
+    case BLOCK64_ERASE_CMD:
+    case CHIP_ERASE_CMD:
+      break;
+
+    default:
+      return;
+  }
+
+  if (!SimWel)
+  {
+    SimStats.IgnoredCommands++;
+    return;
+  }
+
+  switch (SimCmd)
+  {
+    case PAGE_PROG_CMD:
+      if (SimCount < 5)
+      {
+        SimStats.IgnoredCommands++;
+        return;
+      }
+      /* Programming only clears bits */
+      page = SimAddress & SIM_ADDRESS_MASK & ~(MEMORY_PAGE_SIZE - 1);
+      for (i = 0; i < MEMORY_PAGE_SIZE; i++)
+      {
+        SimMemory[page + i] &= SimPage[i];
+      }
+      W25Q80_Sim_StartBusy(W25Q80_SIM_PAGE_PROG_NS);
+      SimStats.PagePrograms++;
+      return;
+
+    case SECTOR_ERASE_CMD:
+    case BLOCK32_ERASE_CMD:
+    case BLOCK64_ERASE_CMD:
+      /* The opcode and the address only */
+      if (SimCount != 4)
+      {
+        SimStats.IgnoredCommands++;
+        return;
+      }
+      if (SimCmd == SECTOR_ERASE_CMD)
+      {
+        W25Q80_Sim_Erase(MEMORY_SECTOR_SIZE, W25Q80_SIM_SECTOR_ERASE_NS, &SimStats.SectorErases);
+      }
+      else if (SimCmd == BLOCK32_ERASE_CMD)
+      {
+        W25Q80_Sim_Erase(MEMORY_BLOCK32_SIZE, W25Q80_SIM_BLOCK32_ERASE_NS, &SimStats.Block32Erases);
+      }
+      else
+      {
+        W25Q80_Sim_Erase(MEMORY_BLOCK_SIZE, W25Q80_SIM_BLOCK64_ERASE_NS, &SimStats.Block64Erases);
+      }
+      return;
+
+    default:
+      if (SimCount != 1)
+      {
+        SimStats.IgnoredCommands++;
+        return;
+      }
+      SimAddress = 0;
+      W25Q80_Sim_Erase(MEMORY_FLASH_SIZE, W25Q80_SIM_CHIP_ERASE_NS, &SimStats.ChipErases);
+      return;
+  }
+}
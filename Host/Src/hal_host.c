@@ -0,0 +1,504 @@
+/**
+  ******************************************************************************
+  * @file    hal_host.c
+  * @brief   Host stand-in for the HAL calls used by W25QXX.c and
+  *          Loader_Src.c, and a model of the SPI3 and GPIOD registers
+  *          used by the register layer of W25Qx_SPI.h. SPI3 transfers are
+  *          exchanged byte per byte with the W25Q80 simulator, PD2 drives
+  *          its chip select and the tick
+  *          follows the simulator clock. DMA transfers complete before the
+  *          start call returns, their callbacks are called from it, unless
+  *          HAL_HOST_DMA_DEFERRED holds them back for the poll points.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "hal_host.h"
+#include "W25Q80_Sim.h"
+#include "spi.h"
+#include "gpio.h"
+#include "dma.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+SCB_Type HostSCB;
+CoreDebug_Type HostCoreDebug;
+DWT_Type HostDWT;
+GPIO_TypeDef HostGPIOD;
+
+uint32_t SystemCoreClock = HAL_HOST_HCLK_HZ;
+
+SPI_HandleTypeDef hspi3;
+static SPI_TypeDef HostSPI3;
+
+/* Register model of SPI3: response bytes and the time each one enters the
+   RX FIFO, end of the wire time of the last byte written to DR */
+#define HAL_HOST_RX_FIFO_SIZE 4
+static uint8_t HostSpiRxData[HAL_HOST_RX_FIFO_SIZE];
+static uint64_t HostSpiRxTime[HAL_HOST_RX_FIFO_SIZE];
+static uint32_t HostSpiRxHead;
+static uint32_t HostSpiRxCount;
+static uint64_t HostSpiWireEnd;
+
+/* Deferred DMA transfer: the bytes moved so far, the offset and the time
+   of its half transfer callback (0 for a transmit) and its end time */
+static SPI_HandleTypeDef *HostDmaHandle;
+#if HAL_HOST_DMA_DEFERRED
+static uint8_t *HostDmaTx;
+static uint8_t *HostDmaRx;
+static uint16_t HostDmaSize;
+static uint16_t HostDmaDone;
+static uint16_t HostDmaHalf;
+static uint64_t HostDmaHalfTime;
+static uint64_t HostDmaEndTime;
+static uint8_t HostDmaInCallback;
+#endif
+
+uint32_t HalHost_Primask;
+uint32_t HalHost_DmaSeed = 1;
+uint32_t HalHost_SpiCallNs = HAL_HOST_SPI_CALL_NS;
+uint32_t HalHost_DmaCallNs = HAL_HOST_DMA_CALL_NS;
+uint32_t HalHost_GpioCallNs = HAL_HOST_GPIO_CALL_NS;
+uint32_t HalHost_RegAccessNs = HAL_HOST_REG_ACCESS_NS;
+uint8_t HalHost_MisoStuckHigh;
+uint8_t HalHost_SpiStalled;
+
+static void HalHost_Advance(uint64_t Ns);
+static uint64_t HalHost_ByteNs(SPI_TypeDef *SPIx);
+static uint8_t HalHost_Transfer(uint8_t Mosi);
+static void HalHost_Exchange(SPI_TypeDef *SPIx, const uint8_t *pTx, uint8_t *pRx, uint16_t Size, uint32_t GapNs);
+static void HalHost_ChipSelect(GPIO_PinState PinState);
+#if HAL_HOST_DMA_DEFERRED
+static uint32_t HalHost_DmaRandom(uint32_t Range);
+static HAL_StatusTypeDef HalHost_DmaStart(SPI_HandleTypeDef *hspi, uint8_t *pTx, uint8_t *pRx, uint16_t Size);
+static void HalHost_DmaMove(uint16_t End);
+#endif
+
+/**
+  * @brief  Moves the simulator clock forward, with the cycle counter.
+  * @param  Ns: Elapsed time in ns
+  * @retval None
+  */
+static void HalHost_Advance(uint64_t Ns)
+{
+  W25Q80_Sim_Advance(Ns);
+  HostDWT.CYCCNT = (uint32_t)(W25Q80_Sim_Now() * (HAL_HOST_HCLK_HZ / 1000000U) / 1000U);
+}
+
+/**
+  * @brief  Wire time of a byte at the SPI clock set in CR1.
+  * @param  SPIx: SPI instance
+  * @retval Time in ns
+  */
+static uint64_t HalHost_ByteNs(SPI_TypeDef *SPIx)
+{
+  uint32_t divider = 2U << ((SPIx->CR1 & SPI_CR1_BR) >> 3);
+
+  return (8ULL * divider * 1000000000ULL) / HAL_HOST_APB1_HZ;
+}
+
+/**
+  * @brief  Exchanges one byte with the simulator.
+  * @param  Mosi: Byte sent
+  * @retval Byte received, 0xFF while HalHost_MisoStuckHigh is set
+  */
+static uint8_t HalHost_Transfer(uint8_t Mosi)
+{
+  uint8_t miso = W25Q80_Sim_Transfer(Mosi);
+
+  return HalHost_MisoStuckHigh ? 0xFF : miso;
+}
+
+/**
+  * @brief  Exchanges bytes with the simulator at the SPI clock set in CR1.
+  * @param  SPIx: SPI instance
+  * @param  pTx: Bytes sent, NULL for 0xFF
+  * @param  pRx: Bytes received, may be NULL or equal to pTx
+  * @param  Size: Number of bytes
+  * @param  GapNs: Software time between two bytes
+  * @retval None
+  */
+static void HalHost_Exchange(SPI_TypeDef *SPIx, const uint8_t *pTx, uint8_t *pRx, uint16_t Size, uint32_t GapNs)
+{
+  uint64_t byte_ns = HalHost_ByteNs(SPIx);
+  uint8_t miso;
+  uint16_t i;
+
+  for (i = 0; i < Size; i++)
+  {
+    miso = HalHost_Transfer((pTx != NULL) ? pTx[i] : 0xFF);
+    if (pRx != NULL)
+    {
+      pRx[i] = miso;
+    }
+    HalHost_Advance(byte_ns + GapNs);
+  }
+}
+
+/**
+  * @brief  Drives the simulator chip select from the PD2 level. The SPI3
+  *         model starts each edge idle, as the register layer leaves it,
+  *         so a W25Q80_Sim_Reset of the clock does not strand a byte.
+  * @param  PinState: PD2 level
+  * @retval None
+  */
+static void HalHost_ChipSelect(GPIO_PinState PinState)
+{
+  if (HostDmaHandle != NULL)
+  {
+    /* The rest of the transfer would be clocked with the chip deselected */
+    fprintf(stderr, "chip select moved during a DMA transfer\n");
+    abort();
+  }
+  HostSpiRxCount = 0;
+  HostSpiWireEnd = 0;
+  if (PinState == GPIO_PIN_SET)
+  {
+    HostGPIOD.ODR |= GPIO_PIN_2;
+    W25Q80_Sim_Deselect();
+  }
+  else
+  {
+    HostGPIOD.ODR &= ~(uint32_t)GPIO_PIN_2;
+    W25Q80_Sim_Select();
+  }
+}
+
+/**
+  * @brief  SR read. A byte is in the RX FIFO once its last bit is clocked,
+  *         RXNE needs two of them with FRXTH clear. TXE stays set, the
+  *         register layer never has more than 2 bytes in flight.
+  * @param  SPIx: SPI instance
+  * @retval SR value, 0 while HalHost_SpiStalled is set
+  */
+uint32_t HalHost_ReadSR(SPI_TypeDef *SPIx)
+{
+  uint32_t threshold = ((SPIx->CR2 & SPI_CR2_FRXTH) != 0) ? 1 : 2;
+  uint32_t ready = 0;
+
+  HalHost_Advance(HalHost_RegAccessNs);
+  if (HalHost_SpiStalled)
+  {
+    return 0;
+  }
+  while (ready < HostSpiRxCount &&
+         HostSpiRxTime[(HostSpiRxHead + ready) % HAL_HOST_RX_FIFO_SIZE] <= W25Q80_Sim_Now())
+  {
+    ready++;
+  }
+  return SPI_SR_TXE | ((ready >= threshold) ? SPI_SR_RXNE : 0);
+}
+
+/**
+  * @brief  8-bit DR read, pops the oldest byte of the RX FIFO.
+  * @param  SPIx: SPI instance
+  * @retval Byte received, 0 when the FIFO is empty
+  */
+uint8_t HalHost_ReadDR(SPI_TypeDef *SPIx)
+{
+  uint8_t data = 0;
+
+  (void)SPIx;
+  HalHost_Advance(HalHost_RegAccessNs);
+  if (HostSpiRxCount != 0)
+  {
+    data = HostSpiRxData[HostSpiRxHead];
+    HostSpiRxHead = (HostSpiRxHead + 1) % HAL_HOST_RX_FIFO_SIZE;
+    HostSpiRxCount--;
+  }
+  return data;
+}
+
+/**
+  * @brief  8-bit DR write. The byte is clocked once the previous one is
+  *         out, it is exchanged with the simulator when written and its
+  *         response enters the RX FIFO at the end of its wire time. A
+  *         response finding the FIFO full is lost, as on an overrun.
+  * @param  SPIx: SPI instance
+  * @param  Data: Byte sent
+  * @retval None
+  */
+void HalHost_WriteDR(SPI_TypeDef *SPIx, uint8_t Data)
+{
+  uint64_t start;
+  uint8_t miso;
+
+  HalHost_Advance(HalHost_RegAccessNs);
+  SET_BIT(SPIx->CR1, SPI_CR1_SPE);
+  start = (HostSpiWireEnd > W25Q80_Sim_Now()) ? HostSpiWireEnd : W25Q80_Sim_Now();
+  HostSpiWireEnd = start + HalHost_ByteNs(SPIx);
+  miso = HalHost_Transfer(Data);
+  if (HostSpiRxCount < HAL_HOST_RX_FIFO_SIZE)
+  {
+    HostSpiRxData[(HostSpiRxHead + HostSpiRxCount) % HAL_HOST_RX_FIFO_SIZE] = miso;
+    HostSpiRxTime[(HostSpiRxHead + HostSpiRxCount) % HAL_HOST_RX_FIFO_SIZE] = HostSpiWireEnd;
+    HostSpiRxCount++;
+  }
+}
+
+/**
+  * @brief  BSRR store, PD2 drives the simulator chip select.
+  * @param  GPIOx: GPIO port
+  * @param  Value: Pins set in bits 15:0, pins reset in bits 31:16
+  * @retval None
+  */
+void HalHost_WriteBSRR(GPIO_TypeDef *GPIOx, uint32_t Value)
+{
+  HalHost_Advance(HalHost_RegAccessNs);
+  if (GPIOx == GPIOD && (Value & GPIO_PIN_2) != 0)
+  {
+    HalHost_ChipSelect(GPIO_PIN_SET);
+  }
+  else if (GPIOx == GPIOD && (Value & ((uint32_t)GPIO_PIN_2 << 16)) != 0)
+  {
+    HalHost_ChipSelect(GPIO_PIN_RESET);
+  }
+  GPIOx->ODR = (GPIOx->ODR | (Value & 0xFFFF)) & ~(Value >> 16);
+}
+
+#if HAL_HOST_DMA_DEFERRED
+/**
+  * @brief  Random number of the deferred DMA model.
+  * @param  Range: Number of values
+  * @retval Value below Range
+  */
+static uint32_t HalHost_DmaRandom(uint32_t Range)
+{
+  /* xorshift32 */
+  if (HalHost_DmaSeed == 0)
+  {
+    HalHost_DmaSeed = 1;
+  }
+  HalHost_DmaSeed ^= HalHost_DmaSeed << 13;
+  HalHost_DmaSeed ^= HalHost_DmaSeed >> 17;
+  HalHost_DmaSeed ^= HalHost_DmaSeed << 5;
+  return HalHost_DmaSeed % Range;
+}
+
+/**
+  * @brief  Records a DMA transfer, its bytes move from HalHost_DmaPoll.
+  * @param  hspi: SPI handle
+  * @param  pTx: Bytes sent
+  * @param  pRx: Bytes received, NULL for a transmit
+  * @param  Size: Number of bytes
+  * @retval HAL_BUSY while another transfer is running
+  */
+static HAL_StatusTypeDef HalHost_DmaStart(SPI_HandleTypeDef *hspi, uint8_t *pTx, uint8_t *pRx, uint16_t Size)
+{
+  uint64_t byte_ns = HalHost_ByteNs(hspi->Instance);
+
+  if (HostDmaHandle != NULL)
+  {
+    return HAL_BUSY;
+  }
+  HalHost_Advance(HalHost_DmaCallNs);
+  HostDmaHandle = hspi;
+  HostDmaTx = pTx;
+  HostDmaRx = pRx;
+  HostDmaSize = Size;
+  HostDmaDone = 0;
+  HostDmaHalf = (pRx != NULL) ? Size / 2 : 0;
+  HostDmaHalfTime = W25Q80_Sim_Now() + HostDmaHalf * byte_ns + HalHost_DmaRandom(HAL_HOST_DMA_JITTER_NS);
+  HostDmaEndTime = W25Q80_Sim_Now() + Size * byte_ns + HalHost_DmaRandom(HAL_HOST_DMA_JITTER_NS);
+  if (HostDmaEndTime < HostDmaHalfTime)
+  {
+    HostDmaEndTime = HostDmaHalfTime;
+  }
+  return HAL_OK;
+}
+
+/**
+  * @brief  Exchanges the bytes of the deferred transfer up to End, their
+  *         wire time has already elapsed.
+  * @param  End: Offset of the first byte left
+  * @retval None
+  */
+static void HalHost_DmaMove(uint16_t End)
+{
+  uint8_t miso;
+
+  for (; HostDmaDone < End; HostDmaDone++)
+  {
+    miso = HalHost_Transfer(HostDmaTx[HostDmaDone]);
+    if (HostDmaRx != NULL)
+    {
+      HostDmaRx[HostDmaDone] = miso;
+    }
+  }
+}
+#endif
+
+/**
+  * @brief  Poll point of the CPU. Advances the clock by a random CPU time
+  *         and delivers the callbacks of the deferred DMA transfer that are
+  *         due, unless PRIMASK is set or a callback is already running.
+  * @retval None
+  */
+void HalHost_DmaPoll(void)
+{
+#if HAL_HOST_DMA_DEFERRED
+  SPI_HandleTypeDef *hspi;
+
+  HalHost_Advance(HalHost_DmaRandom(HAL_HOST_DMA_JITTER_NS));
+  while (HostDmaHandle != NULL && HalHost_Primask == 0 && HostDmaInCallback == 0)
+  {
+    hspi = HostDmaHandle;
+    if (HostDmaHalf != 0 && HostDmaDone < HostDmaHalf)
+    {
+      if (W25Q80_Sim_Now() < HostDmaHalfTime)
+      {
+        return;
+      }
+      HalHost_DmaMove(HostDmaHalf);
+      HostDmaInCallback = 1;
+      HAL_SPI_RxHalfCpltCallback(hspi);
+      HostDmaInCallback = 0;
+    }
+    else
+    {
+      if (W25Q80_Sim_Now() < HostDmaEndTime)
+      {
+        return;
+      }
+      HalHost_DmaMove(HostDmaSize);
+      /* The callback may start the next transfer */
+      HostDmaHandle = NULL;
+      HostDmaInCallback = 1;
+      if (HostDmaRx != NULL)
+      {
+        HAL_SPI_RxCpltCallback(hspi);
+      }
+      else
+      {
+        HAL_SPI_TxCpltCallback(hspi);
+      }
+      HostDmaInCallback = 0;
+    }
+  }
+#endif
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+  (void)Timeout;
+  HalHost_Advance(HalHost_SpiCallNs);
+  HalHost_Exchange(hspi->Instance, pData, NULL, Size, 0);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+  (void)Timeout;
+  /* A 2 lines master clocks the buffer out as dummy data */
+  HalHost_Advance(HalHost_SpiCallNs);
+  HalHost_Exchange(hspi->Instance, pData, pData, Size, 0);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout)
+{
+  (void)Timeout;
+  HalHost_Advance(HalHost_SpiCallNs);
+  HalHost_Exchange(hspi->Instance, pTxData, pRxData, Size, 0);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+#if HAL_HOST_DMA_DEFERRED
+  return HalHost_DmaStart(hspi, pData, NULL, Size);
+#endif
+  HalHost_Advance(HalHost_DmaCallNs);
+  HalHost_Exchange(hspi->Instance, pData, NULL, Size, 0);
+  HAL_SPI_TxCpltCallback(hspi);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+  uint16_t half = Size / 2;
+
+#if HAL_HOST_DMA_DEFERRED
+  /* A 2 lines master clocks the buffer out as dummy data */
+  return HalHost_DmaStart(hspi, pData, pData, Size);
+#endif
+  HalHost_Advance(HalHost_DmaCallNs);
+  HalHost_Exchange(hspi->Instance, pData, pData, half, 0);
+  if (half != 0)
+  {
+    HAL_SPI_RxHalfCpltCallback(hspi);
+  }
+  HalHost_Exchange(hspi->Instance, pData + half, pData + half, Size - half, 0);
+  HAL_SPI_RxCpltCallback(hspi);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi)
+{
+  /* The callbacks still due are dropped */
+  if (HostDmaHandle == hspi)
+  {
+    HostDmaHandle = NULL;
+  }
+  return HAL_OK;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+  HalHost_Advance(HalHost_GpioCallNs);
+
+  /* PD2 is the flash chip select */
+  if (GPIOx == GPIOD && GPIO_Pin == GPIO_PIN_2)
+  {
+    HalHost_ChipSelect(PinState);
+  }
+  else if (PinState == GPIO_PIN_SET)
+  {
+    GPIOx->ODR |= GPIO_Pin;
+  }
+  else
+  {
+    GPIOx->ODR &= ~(uint32_t)GPIO_Pin;
+  }
+}
+
+uint32_t HAL_GetTick(void)
+{
+  HalHost_DmaPoll();
+  return (uint32_t)(W25Q80_Sim_Now() / 1000000ULL);
+}
+
+void SystemInit(void)
+{
+}
+
+HAL_StatusTypeDef HAL_Init(void)
+{
+  return HAL_OK;
+}
+
+void SystemClock_Config(void)
+{
+}
+
+void MX_GPIO_Init(void)
+{
+  HAL_GPIO_WritePin(GPIOD, GPIO_PIN_2, GPIO_PIN_SET);
+}
+
+void MX_DMA_Init(void)
+{
+}
+
+void MX_SPI3_Init(void)
+{
+  hspi3.Instance = &HostSPI3;
+  hspi3.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_4;
+  HostSPI3.CR1 = SPI_BAUDRATEPRESCALER_4;
+}
+
+void Error_Handler(void)
+{
+  fprintf(stderr, "Error_Handler called\n");
+  abort();
+}
@@ -0,0 +1,571 @@
+/**
+  ******************************************************************************
+  * @file    host_bench.c
+  * @brief   Benchmark of the loader entry points against the W25Q80
+  *          simulator. Each workload starts from a powered up chip and an
+  *          Init, then reports per entry point the number of calls, the
+  *          modeled wall time and the bus activity (bytes clocked, chip
+  *          select cycles, status bytes read while BUSY). The content is
+  *          checked after each workload so a faster but wrong driver fails.
+  *          The simulator clock also runs while the host moves the data of
+  *          each call over SWD, reported as the Host operation, so the
+  *          flash can work behind it.
+  *
+  *          loader_bench [-c] [-s KB/s] [-o us] [-t dump.bin] [workload...]
+  *            -c         CSV output, one line per workload and entry point
+  *            -s         SWD throughput of the Write, Verify and Read data,
+  *                       0 leaves the host time out (BENCH_SWD_KBPS)
+  *            -o         host cost of each entry point call (BENCH_CALL_US)
+  *            -t         with W25Qx_TRACE, write the W25Qx_Trace block as
+  *                       read over SWD at the end, for w25qx_trace
+  *            workload   full, sparse, unaligned, reflash (all by default)
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "Loader_Src.h"
+#include "W25QXX.h"
+#include "W25Q80_Sim.h"
+#include "hal_host.h"
+#include "Loader_Profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Size of the Write and Verify calls of STM32CubeProgrammer */
+#define BENCH_CHUNK_SIZE      0x2000
+#define BENCH_SECTORS         (MEMORY_FLASH_SIZE / MEMORY_SECTOR_SIZE)
+
+/* Host side of a call: the probe round trips to start the entry point and
+   see it return, and the RAM buffer transfer at the SWD throughput of an
+   ST-LINK/V2 at 4 MHz */
+#ifndef BENCH_SWD_KBPS
+#define BENCH_SWD_KBPS        300
+#endif
+#ifndef BENCH_CALL_US
+#define BENCH_CALL_US         500
+#endif
+
+/* Content of the chip at power up, neither blank nor programmed */
+#define BENCH_POWER_UP_FILL   0x5A
+
+/* Not declared by Loader_Src.h */
+extern uint32_t CheckSum(uint32_t StartAddress, uint32_t Size, uint32_t InitVal);
+
+typedef enum
+{
+  BENCH_INIT = 0,
+  BENCH_MASS_ERASE,
+  BENCH_SECTOR_ERASE,
+  BENCH_WRITE,
+  BENCH_READ,
+  BENCH_CHECKSUM,
+  BENCH_VERIFY,
+  BENCH_HOST,
+  BENCH_OPS
+} Bench_OpTypeDef;
+
+static const char* const BenchOpNames[BENCH_OPS] =
+{
+  "Init", "MassErase", "SectorErase", "Write", "Read", "CheckSum", "Verify", "Host"
+};
+
+#if LOADER_PROFILE
+static const char* const BenchProfileNames[LOADER_PROFILE_COUNT] =
+{
+  "Init", "Read", "Write", "MassErase", "SectorErase", "CheckSum", "Verify",
+  "Crc32", "w25qx command", "w25qx data", "w25qx busy"
+};
+#endif
+
+/* Cost of the calls of one entry point */
+typedef struct
+{
+  uint32_t Calls;
+  uint64_t Bytes;               /* payload of Write, Read, CheckSum, Verify,
+                                   moved over SWD for Host */
+  uint64_t TimeNs;
+  uint64_t BytesOnWire;
+  uint64_t Transactions;
+  uint64_t BusyPolls;
+} Bench_OpStatsTypeDef;
+
+typedef struct
+{
+  const char* Name;
+  void (*Run)(void);
+} Bench_WorkloadTypeDef;
+
+static Bench_OpStatsTypeDef BenchOps[BENCH_OPS];
+static W25Q80_SimStatsTypeDef BenchStart;
+static uint64_t BenchStartNs;
+static int BenchCsv;
+static uint32_t BenchSwdKBps = BENCH_SWD_KBPS;
+static uint32_t BenchCallUs = BENCH_CALL_US;
+static const char* BenchTracePath;
+
+static uint8_t BenchImage[MEMORY_FLASH_SIZE];
+static uint8_t BenchRead[BENCH_CHUNK_SIZE];
+static uint32_t BenchSeed;
+
+static void Bench_Fail(const char* What, uint32_t Address)
+{
+  fprintf(stderr, "FAIL: %s at 0x%06lx\n", What, (unsigned long)Address);
+  exit(1);
+}
+
+static uint32_t Bench_Random(void)
+{
+  /* xorshift32, the same sequence on every run */
+  BenchSeed ^= BenchSeed << 13;
+  BenchSeed ^= BenchSeed >> 17;
+  BenchSeed ^= BenchSeed << 5;
+  return BenchSeed;
+}
+
+/* Time the host spends starting a call (Call != 0) and moving Bytes over
+   SWD, the flash keeps working meanwhile */
+static void Bench_Host(int Call, uint32_t Bytes)
+{
+  Bench_OpStatsTypeDef* op = &BenchOps[BENCH_HOST];
+  uint64_t ns;
+
+  if (BenchSwdKBps == 0)
+    return;
+
+  ns = (Call ? BenchCallUs * 1000ULL : 0) + Bytes * 1000000000ULL / (BenchSwdKBps * 1024ULL);
+  W25Q80_Sim_Advance(ns);
+  op->Calls += (Call != 0);
+  op->Bytes += Bytes;
+  op->TimeNs += ns;
+}
+
+static void Bench_Begin(void)
+{
+  BenchStart = *W25Q80_Sim_Stats();
+  BenchStartNs = W25Q80_Sim_Now();
+}
+
+static void Bench_End(Bench_OpTypeDef Op, uint32_t Bytes)
+{
+  W25Q80_SimStatsTypeDef* stats = W25Q80_Sim_Stats();
+  Bench_OpStatsTypeDef* op = &BenchOps[Op];
+
+  op->Calls++;
+  op->Bytes += Bytes;
+  op->TimeNs += W25Q80_Sim_Now() - BenchStartNs;
+  op->BytesOnWire += stats->BytesOnWire - BenchStart.BytesOnWire;
+  op->Transactions += stats->Transactions - BenchStart.Transactions;
+  op->BusyPolls += stats->BusyPolls - BenchStart.BusyPolls;
+}
+
+/* Entry point calls, timed and checked ---------------------------------------*/
+static void Bench_Init(void)
+{
+  Bench_Host(1, 0);
+  Bench_Begin();
+  if (Init() != LOADER_OK)
+    Bench_Fail("Init", 0);
+  Bench_End(BENCH_INIT, 0);
+}
+
+static void Bench_MassErase(void)
+{
+  Bench_Host(1, 0);
+  Bench_Begin();
+  if (MassErase() != LOADER_OK)
+    Bench_Fail("MassErase", 0);
+  Bench_End(BENCH_MASS_ERASE, 0);
+}
+
+static void Bench_SectorErase(uint32_t Start, uint32_t End)
+{
+  Bench_Host(1, 0);
+  Bench_Begin();
+  if (SectorErase(Start, End) != LOADER_OK)
+    Bench_Fail("SectorErase", Start);
+  Bench_End(BENCH_SECTOR_ERASE, 0);
+}
+
+static void Bench_Write(uint32_t Address, uint32_t Size)
+{
+  /* The data goes to the loader RAM first */
+  Bench_Host(1, Size);
+  Bench_Begin();
+  if (Write(Address, Size, &BenchImage[Address]) != LOADER_OK)
+    Bench_Fail("Write", Address);
+  Bench_End(BENCH_WRITE, Size);
+}
+
+static void Bench_Read(uint32_t Address, uint32_t Size)
+{
+  Bench_Host(1, 0);
+  Bench_Begin();
+  if (Read(Address, Size, BenchRead) != LOADER_OK)
+    Bench_Fail("Read", Address);
+  Bench_End(BENCH_READ, Size);
+  /* The data comes back to the host after the call */
+  Bench_Host(0, Size);
+  if (memcmp(BenchRead, &BenchImage[Address], Size) != 0)
+    Bench_Fail("Read content", Address);
+}
+
+static void Bench_CheckSum(uint32_t Address, uint32_t Size)
+{
+  uint32_t sum = 0, i;
+
+  Bench_Host(1, 0);
+  Bench_Begin();
+  sum = CheckSum(Address, Size, 0);
+  Bench_End(BENCH_CHECKSUM, Size);
+
+  /* Word aligned ranges are a plain byte sum */
+  for (i = 0; i < Size; i++)
+    sum -= BenchImage[Address + i];
+  if (sum != 0)
+    Bench_Fail("CheckSum", Address);
+}
+
+static void Bench_Verify(uint32_t Address, uint32_t Size)
+{
+  uint64_t result;
+
+  Bench_Host(1, Size);
+  Bench_Begin();
+  result = Verify(Address, (uint32_t)(uintptr_t)&BenchImage[Address], Size / 4, 0);
+  Bench_End(BENCH_VERIFY, Size);
+  if ((uint32_t)result != 0)
+    Bench_Fail("Verify", (uint32_t)result);
+}
+
+/* Programs the image range by range, as STM32CubeProgrammer does */
+static void Bench_Program(uint32_t Address, uint32_t Size)
+{
+  uint32_t chunk;
+
+  for (; Size != 0; Address += chunk, Size -= chunk)
+  {
+    chunk = (Size < BENCH_CHUNK_SIZE) ? Size : BENCH_CHUNK_SIZE;
+    Bench_Write(Address, chunk);
+  }
+}
+
+static void Bench_VerifyRange(uint32_t Address, uint32_t Size)
+{
+  uint32_t chunk;
+
+  for (; Size != 0; Address += chunk, Size -= chunk)
+  {
+    chunk = (Size < BENCH_CHUNK_SIZE) ? Size : BENCH_CHUNK_SIZE;
+    Bench_Verify(Address, chunk);
+  }
+}
+
+/* Whole memory against the image, outside of the statistics */
+static void Bench_CheckContent(void)
+{
+  uint8_t* memory = W25Q80_Sim_Memory();
+  uint32_t i;
+
+  for (i = 0; i < MEMORY_FLASH_SIZE; i++)
+  {
+    if (memory[i] != BenchImage[i])
+      Bench_Fail("flash content", i);
+  }
+}
+
+/* Workloads -----------------------------------------------------------------*/
+/* 1 MiB of random data: mass erase, program, verify, read back */
+static void Bench_Full(void)
+{
+  uint32_t i, address;
+
+  for (i = 0; i < MEMORY_FLASH_SIZE; i++)
+    BenchImage[i] = (uint8_t)Bench_Random();
+
+  Bench_MassErase();
+  Bench_Program(0, MEMORY_FLASH_SIZE);
+  Bench_VerifyRange(0, MEMORY_FLASH_SIZE);
+  for (address = 0; address < MEMORY_FLASH_SIZE; address += BENCH_CHUNK_SIZE)
+    Bench_Read(address, BENCH_CHUNK_SIZE);
+  Bench_CheckSum(0, MEMORY_FLASH_SIZE);
+  Bench_CheckContent();
+}
+
+/* One sector out of four holds data, half of its pages blank: the host
+   erases and programs only those sectors, the others keep their content */
+static void Bench_Sparse(void)
+{
+  uint32_t sector, page, i, address;
+
+  memset(BenchImage, BENCH_POWER_UP_FILL, sizeof(BenchImage));
+  for (sector = 0; sector < BENCH_SECTORS; sector += 4)
+  {
+    address = sector * MEMORY_SECTOR_SIZE;
+    memset(&BenchImage[address], MEMORY_ERASE_VALUE, MEMORY_SECTOR_SIZE);
+    for (page = 0; page < MEMORY_SECTOR_SIZE; page += 2 * MEMORY_PAGE_SIZE)
+    {
+      for (i = 0; i < MEMORY_PAGE_SIZE; i++)
+        BenchImage[address + page + i] = (uint8_t)Bench_Random();
+    }
+  }
+
+  for (sector = 0; sector < BENCH_SECTORS; sector += 4)
+  {
+    address = sector * MEMORY_SECTOR_SIZE;
+    Bench_SectorErase(address, address + MEMORY_SECTOR_SIZE - 1);
+    Bench_Program(address, MEMORY_SECTOR_SIZE);
+    Bench_Verify(address, MEMORY_SECTOR_SIZE);
+  }
+  Bench_CheckSum(0, MEMORY_FLASH_SIZE);
+  Bench_CheckContent();
+}
+
+/* Short writes at odd addresses into a freshly erased 64KB area, each read
+   back, as done when patching configuration data */
+static void Bench_Unaligned(void)
+{
+  uint32_t address, size, i;
+
+  memset(BenchImage, MEMORY_ERASE_VALUE, sizeof(BenchImage));
+  Bench_MassErase();
+
+  for (address = 1; address < MEMORY_BLOCK_SIZE; address += size + 1 + Bench_Random() % 61)
+  {
+    size = 1 + Bench_Random() % 37;
+    if (address + size > MEMORY_BLOCK_SIZE)
+      break;
+    for (i = 0; i < size; i++)
+      BenchImage[address + i] = (uint8_t)Bench_Random();
+    Bench_Write(address, size);
+    Bench_Read(address, size);
+  }
+  Bench_CheckContent();
+}
+
+/* The 1 MiB image programmed, then programmed again with a few bytes
+   changed in one sector out of 16, sector erase by sector erase */
+static void Bench_Reflash(void)
+{
+  uint32_t pass, sector, i;
+
+  for (i = 0; i < MEMORY_FLASH_SIZE; i++)
+    BenchImage[i] = (uint8_t)Bench_Random();
+
+  for (pass = 0; pass < 2; pass++)
+  {
+    if (pass != 0)
+    {
+      for (sector = 0; sector < BENCH_SECTORS; sector += 16)
+      {
+        for (i = 0; i < 8; i++)
+          BenchImage[sector * MEMORY_SECTOR_SIZE + Bench_Random() % MEMORY_SECTOR_SIZE] ^= 0x5A;
+      }
+    }
+
+    /* The in place update modes compare and erase in Write, the host
+       erase is left off for them */
+#if !LOADER_IN_PLACE_UPDATE
+    Bench_SectorErase(0, MEMORY_FLASH_SIZE - 1);
+#endif
+    Bench_Program(0, MEMORY_FLASH_SIZE);
+    Bench_VerifyRange(0, MEMORY_FLASH_SIZE);
+  }
+  Bench_CheckContent();
+}
+
+static const Bench_WorkloadTypeDef BenchWorkloads[] =
+{
+  { "full",      Bench_Full },
+  { "sparse",    Bench_Sparse },
+  { "unaligned", Bench_Unaligned },
+  { "reflash",   Bench_Reflash },
+};
+
+#define BENCH_WORKLOADS  (sizeof(BenchWorkloads) / sizeof(BenchWorkloads[0]))
+
+/* Report --------------------------------------------------------------------*/
+static void Bench_Report(const char* Workload)
+{
+  Bench_OpStatsTypeDef total;
+  Bench_OpStatsTypeDef* op;
+  int i;
+
+  memset(&total, 0, sizeof(total));
+  if (!BenchCsv)
+  {
+    printf("\n%s\n", Workload);
+    printf("  %-12s %7s %10s %12s %12s %10s %10s %9s\n",
+           "operation", "calls", "bytes", "time_us", "wire_bytes", "cs_cycles", "busy_poll", "KB/s");
+  }
+
+  for (i = 0; i <= BENCH_OPS; i++)
+  {
+    if (i < BENCH_OPS)
+    {
+      op = &BenchOps[i];
+      if (op->Calls == 0)
+        continue;
+      /* The host time adds up, its calls and bytes are those of the
+         entry points */
+      if (i != BENCH_HOST)
+      {
+        total.Calls += op->Calls;
+        total.Bytes += op->Bytes;
+      }
+      total.TimeNs += op->TimeNs;
+      total.BytesOnWire += op->BytesOnWire;
+      total.Transactions += op->Transactions;
+      total.BusyPolls += op->BusyPolls;
+    }
+    else
+    {
+      op = &total;
+    }
+
+    if (BenchCsv)
+    {
+      printf("%s,%s,%lu,%llu,%llu,%llu,%llu,%llu\n", Workload,
+             (i < BENCH_OPS) ? BenchOpNames[i] : "total", (unsigned long)op->Calls,
+             (unsigned long long)op->Bytes, (unsigned long long)op->TimeNs,
+             (unsigned long long)op->BytesOnWire, (unsigned long long)op->Transactions,
+             (unsigned long long)op->BusyPolls);
+    }
+    else
+    {
+      printf("  %-12s %7lu %10llu %12.1f %12llu %10llu %10llu %9.1f\n",
+             (i < BENCH_OPS) ? BenchOpNames[i] : "total", (unsigned long)op->Calls,
+             (unsigned long long)op->Bytes, op->TimeNs / 1000.0,
+             (unsigned long long)op->BytesOnWire, (unsigned long long)op->Transactions,
+             (unsigned long long)op->BusyPolls,
+             (op->TimeNs != 0 && op->Bytes != 0) ? op->Bytes * 1e6 / op->TimeNs : 0.0);
+    }
+  }
+}
+
+#if LOADER_PROFILE
+/* LoaderProfile as read over SWD, in cycles of HAL_HOST_HCLK_HZ */
+static void Bench_ReportProfile(void)
+{
+  volatile Loader_ProfileEntryTypeDef* entry;
+  int i;
+
+  printf("  %-14s %7s %10s %10s %12s\n", "profile", "calls", "min", "max", "total");
+  for (i = 0; i < LOADER_PROFILE_COUNT; i++)
+  {
+    entry = &LoaderProfile.Entry[i];
+    if (entry->Calls == 0)
+      continue;
+    printf("  %-14s %7lu %10lu %10lu %12llu\n", BenchProfileNames[i],
+           (unsigned long)entry->Calls, (unsigned long)entry->Min,
+           (unsigned long)entry->Max, (unsigned long long)entry->Total);
+  }
+}
+#endif
+
+static void Bench_Run(const Bench_WorkloadTypeDef* Workload)
+{
+  memset(BenchOps, 0, sizeof(BenchOps));
+#if LOADER_PROFILE
+  memset((void*)LoaderProfile.Entry, 0, sizeof(LoaderProfile.Entry));
+#endif
+  BenchSeed = 0x2545F491;
+
+  W25Q80_Sim_Reset(BENCH_POWER_UP_FILL);
+  Bench_Init();
+  Workload->Run();
+  Bench_Report(Workload->Name);
+#if LOADER_PROFILE
+  if (!BenchCsv)
+    Bench_ReportProfile();
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+  int i, selected = 0;
+  uint32_t w;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-c") == 0)
+    {
+      BenchCsv = 1;
+      continue;
+    }
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc && W25Qx_TRACE)
+    {
+      BenchTracePath = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+    {
+      BenchSwdKBps = (uint32_t)strtoul(argv[++i], NULL, 0);
+      continue;
+    }
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+    {
+      BenchCallUs = (uint32_t)strtoul(argv[++i], NULL, 0);
+      continue;
+    }
+    for (w = 0; w < BENCH_WORKLOADS; w++)
+    {
+      if (strcmp(argv[i], BenchWorkloads[w].Name) == 0)
+        break;
+    }
+    if (w == BENCH_WORKLOADS)
+    {
+      fprintf(stderr, "usage: %s [-c] [-s KB/s] [-o us] [-t dump.bin] [full] [sparse] [unaligned] [reflash]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (BenchCsv)
+  {
+    printf("workload,operation,calls,bytes,time_ns,wire_bytes,cs_cycles,busy_polls\n");
+  }
+  else
+  {
+    printf("SPI3 kernel clock %lu MHz, HAL call %lu ns, DMA call %lu ns, chip select %lu ns\n",
+           (unsigned long)(HAL_HOST_APB1_HZ / 1000000), (unsigned long)HalHost_SpiCallNs,
+           (unsigned long)HalHost_DmaCallNs, (unsigned long)HalHost_GpioCallNs);
+    printf("SWD %lu KB/s, host call %lu us\n", (unsigned long)BenchSwdKBps, (unsigned long)BenchCallUs);
+  }
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "-o") == 0)
+    {
+      i++;
+      continue;
+    }
+    for (w = 0; w < BENCH_WORKLOADS; w++)
+    {
+      if (strcmp(argv[i], BenchWorkloads[w].Name) == 0)
+      {
+        Bench_Run(&BenchWorkloads[w]);
+        selected = 1;
+      }
+    }
+  }
+
+  if (!selected)
+  {
+    for (w = 0; w < BENCH_WORKLOADS; w++)
+      Bench_Run(&BenchWorkloads[w]);
+  }
+
+#if W25Qx_TRACE
+  if (BenchTracePath != NULL)
+  {
+    FILE* file = fopen(BenchTracePath, "wb");
+
+    if (file == NULL || fwrite(&W25Qx_Trace, sizeof(W25Qx_Trace), 1, file) != 1 || fclose(file) != 0)
+    {
+      fprintf(stderr, "%s: write error\n", BenchTracePath);
+      return 1;
+    }
+  }
+#endif
+  return 0;
+}
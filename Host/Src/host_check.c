@@ -0,0 +1,253 @@
+/**
+  ******************************************************************************
+  * @file    host_check.c
+  * @brief   Randomized equivalence of CheckSum, Verify and Crc32 with the
+  *          implementations they replaced: the word loop CheckSum and the
+  *          CheckSum then byte compare Verify of the original loader, and a
+  *          bitwise CRC-32. Ranges, alignments and RAM buffer offsets are
+  *          drawn at random over random flash content. Exits with 1 on the
+  *          first difference. Built with HAL_HOST_DMA_DEFERRED, the seed
+  *          also draws the DMA completion times of the stream reads.
+  *
+  *          loader_check [seed [iterations]]
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "Loader_Src.h"
+#include "W25QXX.h"
+#include "W25Q80_Sim.h"
+#include "hal_host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Longest range checked, more than the Verify calls of STM32CubeProgrammer */
+#define CHECK_MAX_SIZE        0x2400
+
+/* Memory mapped base the programmer may pass, the loader masks it */
+#define CHECK_BIAS_ADDRESS    0x90000000
+
+/* Not declared by Loader_Src.h */
+extern uint32_t CheckSum(uint32_t StartAddress, uint32_t Size, uint32_t InitVal);
+
+static uint8_t* CheckMemory;
+static uint32_t CheckRandomState;
+static uint8_t CheckBuffer[CHECK_MAX_SIZE + 8];
+
+static uint32_t Check_Random(uint32_t Range)
+{
+  /* xorshift32 */
+  CheckRandomState ^= CheckRandomState << 13;
+  CheckRandomState ^= CheckRandomState >> 17;
+  CheckRandomState ^= CheckRandomState << 5;
+  return CheckRandomState % Range;
+}
+
+static void Check_Fail(const char* What, uint32_t Iteration, uint32_t Address, uint32_t Size)
+{
+  fprintf(stderr, "FAIL: %s (iteration %lu, address 0x%08lX, size %lu)\n", What,
+          (unsigned long)Iteration, (unsigned long)Address, (unsigned long)Size);
+  exit(1);
+}
+
+/* CheckSum of the original loader, reading the simulated memory instead
+   of one byte Read calls */
+static uint32_t Check_RefCheckSum(uint32_t StartAddress, uint32_t Size, uint32_t InitVal)
+{
+  uint8_t missalignementAddress = StartAddress%4;
+  uint8_t missalignementSize = Size ;
+  int cnt;
+  uint32_t Val;
+  const uint8_t* value;
+
+  StartAddress-=StartAddress%4;
+  Size += (Size%4==0)?0:4-(Size%4);
+
+  for(cnt=0; cnt<Size ; cnt+=4)
+  {
+    value = &CheckMemory[StartAddress & 0x0fffffff];
+    Val = value[0];
+    Val += value[1]<<8;
+    Val += value[2]<<16;
+    Val += (uint32_t)value[3]<<24;
+
+    if(missalignementAddress)
+    {
+      switch (missalignementAddress)
+      {
+        case 1:
+          InitVal += (uint8_t) (Val>>8 & 0xff);
+          InitVal += (uint8_t) (Val>>16 & 0xff);
+          InitVal += (uint8_t) (Val>>24 & 0xff);
+          missalignementAddress-=1;
+          break;
+        case 2:
+          InitVal += (uint8_t) (Val>>16 & 0xff);
+          InitVal += (uint8_t) (Val>>24 & 0xff);
+          missalignementAddress-=2;
+          break;
+        case 3:
+          InitVal += (uint8_t) (Val>>24 & 0xff);
+          missalignementAddress-=3;
+          break;
+      }
+    }
+    else if((Size-missalignementSize)%4 && (Size-cnt) <=4)
+    {
+      switch (Size-missalignementSize)
+      {
+        case 1:
+          InitVal += (uint8_t) Val;
+          InitVal += (uint8_t) (Val>>8 & 0xff);
+          InitVal += (uint8_t) (Val>>16 & 0xff);
+          missalignementSize-=1;
+          break;
+        case 2:
+          InitVal += (uint8_t) Val;
+          InitVal += (uint8_t) (Val>>8 & 0xff);
+          missalignementSize-=2;
+          break;
+        case 3:
+          InitVal += (uint8_t) Val;
+          missalignementSize-=3;
+          break;
+      }
+    }
+    else
+    {
+      InitVal += (uint8_t) Val;
+      InitVal += (uint8_t) (Val>>8 & 0xff);
+      InitVal += (uint8_t) (Val>>16 & 0xff);
+      InitVal += (uint8_t) (Val>>24 & 0xff);
+    }
+
+    StartAddress += 4;
+  }
+
+  return (InitVal);
+}
+
+/* Verify of the original loader */
+static uint64_t Check_RefVerify(uint32_t MemoryAddr, const uint8_t* Buffer, uint32_t Size, uint32_t missalignement)
+{
+  uint32_t VerifiedData = 0;
+  uint64_t checksum;
+
+  Size *= 4;
+
+  checksum = Check_RefCheckSum(MemoryAddr + (missalignement & 0xf), Size - ((missalignement >> 16) & 0xF), 0);
+
+  while (Size>VerifiedData)
+  {
+    if (CheckMemory[(MemoryAddr + VerifiedData) & 0x0fffffff] != Buffer[VerifiedData])
+      return ((checksum<<32) + MemoryAddr + VerifiedData);
+
+    VerifiedData++;
+  }
+
+  return (checksum<<32);
+}
+
+#if LOADER_CRC32
+/* Bitwise reflected CRC-32, as zlib crc32() */
+static uint32_t Check_RefCrc32(uint32_t Address, uint32_t Size, uint32_t Crc)
+{
+  uint32_t i;
+
+  Crc = ~Crc;
+  for (; Size > 0; Size--)
+  {
+    Crc ^= CheckMemory[Address++];
+    for (i = 0; i < 8; i++)
+    {
+      Crc = (Crc >> 1) ^ ((Crc & 1) ? 0xEDB88320 : 0);
+    }
+  }
+  return ~Crc;
+}
+#endif
+
+/* Flash address of a range of Size bytes and up to 4 bytes after it */
+static uint32_t Check_RandomAddress(uint32_t Size)
+{
+  return Check_Random(MEMORY_FLASH_SIZE - Size - 4);
+}
+
+int main(int argc, char** argv)
+{
+  uint32_t seed = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 1;
+  uint32_t iterations = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 2000;
+  uint32_t n, i, address, size, words, head, tail, init;
+#if LOADER_CRC32
+  uint32_t split;
+#endif
+  uint8_t* buffer;
+  uint64_t result, expected;
+
+  CheckRandomState = (seed != 0) ? seed : 1;
+  HalHost_DmaSeed = CheckRandomState;
+  W25Q80_Sim_Reset(MEMORY_ERASE_VALUE);
+  if (Init() != LOADER_OK)
+    Check_Fail("Init", 0, 0, 0);
+
+  /* Random content with erased runs, written behind the loader */
+  CheckMemory = W25Q80_Sim_Memory();
+  for (i = 0; i < MEMORY_FLASH_SIZE; i++)
+  {
+    CheckMemory[i] = (uint8_t)Check_Random(256);
+  }
+  for (n = 0; n < 64; n++)
+  {
+    size = Check_Random(CHECK_MAX_SIZE);
+    memset(&CheckMemory[Check_RandomAddress(size)], MEMORY_ERASE_VALUE, size);
+  }
+
+  for (n = 0; n < iterations; n++)
+  {
+    /* CheckSum, sizes on both sides of the 256 bytes of the original
+       uint8_t size tracking */
+    size = (Check_Random(4) == 0) ? Check_Random(300) : Check_Random(CHECK_MAX_SIZE);
+    address = Check_RandomAddress(size) | (Check_Random(2) ? CHECK_BIAS_ADDRESS : 0);
+    init = (Check_Random(2) != 0) ? Check_Random(0xFFFFFFFF) : 0;
+    if (CheckSum(address, size, init) != Check_RefCheckSum(address, size, init))
+      Check_Fail("CheckSum", n, address, size);
+
+    /* Verify of matching data then of a single different byte, from a
+       RAM buffer at any alignment */
+    words = 1 + Check_Random(CHECK_MAX_SIZE / 4);
+    address = Check_RandomAddress(words * 4) | (Check_Random(2) ? CHECK_BIAS_ADDRESS : 0);
+    head = Check_Random(4);
+    tail = Check_Random(4);
+    buffer = &CheckBuffer[Check_Random(8)];
+    memcpy(buffer, &CheckMemory[address & 0x0fffffff], words * 4);
+    for (i = 0; i < 2; i++)
+    {
+      result = Verify(address, (uint32_t)(uintptr_t)buffer, words, (tail << 16) | head);
+      expected = Check_RefVerify(address, buffer, words, (tail << 16) | head);
+      if (result != expected)
+        Check_Fail(i ? "Verify mismatch" : "Verify", n, address, words * 4);
+      buffer[Check_Random(words * 4)] ^= (uint8_t)(1 + Check_Random(255));
+    }
+
+#if LOADER_CRC32
+    /* Crc32 of a range, and continued over a second one */
+    size = Check_Random(CHECK_MAX_SIZE);
+    address = Check_RandomAddress(size);
+    split = Check_Random(size + 1);
+    init = Crc32(address | CHECK_BIAS_ADDRESS, split, 0);
+    if (init != Check_RefCrc32(address, split, 0))
+      Check_Fail("Crc32", n, address, split);
+    if (Crc32(address + split, size - split, init) != Check_RefCrc32(address, size, 0))
+      Check_Fail("Crc32 continued", n, address, size);
+#endif
+  }
+
+  printf("host loader check passed\n");
+  printf("  seed             %lu\n", (unsigned long)seed);
+  printf("  iterations       %lu\n", (unsigned long)iterations);
+  printf("  simd checksum    %d\n", LOADER_SIMD_CHECKSUM);
+  printf("  crc32            %d\n", LOADER_CRC32);
+  printf("  deferred dma     %d\n", HAL_HOST_DMA_DEFERRED);
+  return 0;
+}
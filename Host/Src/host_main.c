@@ -0,0 +1,221 @@
+/**
+  ******************************************************************************
+  * @file    host_main.c
+  * @brief   Linux run of the loader entry points against the W25Q80
+  *          simulator: the sequence of Core/Src/main.c with every result
+  *          checked against the simulated memory. Exits with 1 on the first
+  *          failure.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "Loader_Src.h"
+#include "W25QXX.h"
+#include "W25Q80_Sim.h"
+#include "hal_host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SECTORS_COUNT  (MEMORY_FLASH_SIZE / MEMORY_SECTOR_SIZE)
+#define SUM_SIZE       128
+/* Write size of the unchanged image test, not a multiple of a sector */
+#define UPDATE_CHUNK   3000
+
+/* Not declared by Loader_Src.h */
+extern uint32_t CheckSum(uint32_t StartAddress, uint32_t Size, uint32_t InitVal);
+
+static uint8_t wData[MEMORY_SECTOR_SIZE];
+static uint8_t rData[MEMORY_SECTOR_SIZE];
+#if LOADER_IN_PLACE_UPDATE
+static uint8_t image[MEMORY_FLASH_SIZE];
+#endif
+
+static void Host_Check(int Condition, const char* What, uint32_t Sector)
+{
+  if (!Condition)
+  {
+    fprintf(stderr, "FAIL: %s (sector %lu)\n", What, (unsigned long)Sector);
+    exit(1);
+  }
+}
+
+int main(void)
+{
+  W25Q80_SimStatsTypeDef* stats = W25Q80_Sim_Stats();
+  uint8_t* memory = W25Q80_Sim_Memory();
+  uint8_t ID[2];
+  uint32_t i, j, address, sum;
+  uint64_t result, start;
+#if LOADER_IN_PLACE_UPDATE
+  Loader_StatsTypeDef before;
+  uint32_t programs, erases;
+#endif
+
+  /* Powers up with random looking content */
+  W25Q80_Sim_Reset(0x5A);
+
+  Host_Check(Init() == LOADER_OK, "Init", 0);
+  Host_Check(BSP_W25Qx_Read_ID(ID) == W25Qx_OK, "Read_ID status", 0);
+  Host_Check(ID[0] == W25Q80_SIM_MANUFACTURER_ID && ID[1] == W25Q80_SIM_DEVICE_ID, "Read_ID", 0);
+
+  /* Erase and blank check */
+  Host_Check(MassErase() == LOADER_OK, "MassErase", 0);
+  for (i = 0; i < SECTORS_COUNT; i++)
+  {
+    memset(rData, 0, sizeof(rData));
+    Host_Check(Read(i * MEMORY_SECTOR_SIZE, MEMORY_SECTOR_SIZE, rData) == LOADER_OK, "Read blank", i);
+    for (j = 0; j < MEMORY_SECTOR_SIZE; j++)
+    {
+      Host_Check(rData[j] == MEMORY_ERASE_VALUE, "blank content", i);
+    }
+  }
+
+  /* Erase, program and read back every sector */
+  for (i = 0; i < SECTORS_COUNT; i++)
+  {
+    address = i * MEMORY_SECTOR_SIZE;
+    for (j = 0; j < MEMORY_SECTOR_SIZE; j++)
+    {
+      wData[j] = (uint8_t)(i * 7 + j + (j >> 8));
+    }
+
+    Host_Check(SectorErase(address, address + MEMORY_SECTOR_SIZE - 1) == LOADER_OK, "SectorErase", i);
+    Host_Check(Write(address, MEMORY_SECTOR_SIZE, wData) == LOADER_OK, "Write", i);
+    memset(rData, 0, sizeof(rData));
+    Host_Check(Read(address, MEMORY_SECTOR_SIZE, rData) == LOADER_OK, "Read", i);
+    Host_Check(memcmp(rData, wData, MEMORY_SECTOR_SIZE) == 0, "read back", i);
+    Host_Check(memcmp(&memory[address], wData, MEMORY_SECTOR_SIZE) == 0, "flash content", i);
+
+    /* Verify returns the checksum in R1, R0 is 0 on success or the
+       address of the first difference */
+    result = Verify(address, (uint32_t)(uintptr_t)wData, MEMORY_SECTOR_SIZE / 4, 0);
+    Host_Check((uint32_t)result == 0, "Verify", i);
+    Host_Check((uint32_t)(result >> 32) == CheckSum(address, MEMORY_SECTOR_SIZE, 0), "Verify checksum", i);
+    wData[100] ^= 1;
+    result = Verify(address, (uint32_t)(uintptr_t)wData, MEMORY_SECTOR_SIZE / 4, 0);
+    Host_Check((uint32_t)result == address + 100, "Verify mismatch", i);
+  }
+
+  /* Byte sum of a word aligned range */
+  address = 3 * MEMORY_SECTOR_SIZE + 8;
+  sum = 0;
+  for (j = 0; j < SUM_SIZE; j++)
+  {
+    sum += memory[address + j];
+  }
+  Host_Check(CheckSum(address, SUM_SIZE, 0) == sum, "CheckSum", 3);
+
+#if LOADER_CRC32
+  /* Bitwise reflected CRC-32 of an unaligned range */
+  address = 5 * MEMORY_SECTOR_SIZE + 3;
+  sum = 0xFFFFFFFF;
+  for (j = 0; j < MEMORY_SECTOR_SIZE; j++)
+  {
+    sum ^= memory[address + j];
+    for (i = 0; i < 8; i++)
+    {
+      sum = (sum >> 1) ^ ((sum & 1) ? 0xEDB88320 : 0);
+    }
+  }
+  Host_Check(Crc32(address, MEMORY_SECTOR_SIZE, 0) == ~sum, "Crc32", 5);
+#endif
+
+#if LOADER_IN_PLACE_UPDATE
+  /* The programmed image written again in a new session, without erase and
+     in chunks across the sector boundaries: every sector compares equal
+     once, and nothing is erased */
+  memcpy(image, memory, MEMORY_FLASH_SIZE);
+  Host_Check(Init() == LOADER_OK, "Init", 0);
+  before = *(Loader_StatsTypeDef*)&LoaderStats;
+  programs = stats->PagePrograms;
+  erases = stats->SectorErases + stats->Block32Erases + stats->Block64Erases;
+  for (address = 0; address < MEMORY_FLASH_SIZE; address += sum)
+  {
+    sum = (MEMORY_FLASH_SIZE - address < UPDATE_CHUNK) ? MEMORY_FLASH_SIZE - address : UPDATE_CHUNK;
+    Host_Check(Write(address, sum, &image[address]) == LOADER_OK, "Write unchanged", address / MEMORY_SECTOR_SIZE);
+  }
+  Host_Check(memcmp(memory, image, MEMORY_FLASH_SIZE) == 0, "unchanged content", 0);
+  Host_Check(stats->SectorErases + stats->Block32Erases + stats->Block64Erases == erases, "unchanged erases", 0);
+  Host_Check(LoaderStats.RewrittenSectors == before.RewrittenSectors, "unchanged rewritten sectors", 0);
+#if LOADER_DIFFERENTIAL_REFLASH
+  Host_Check(stats->PagePrograms == programs, "unchanged page programs", 0);
+  Host_Check(LoaderStats.UnchangedSectors - before.UnchangedSectors == SECTORS_COUNT, "UnchangedSectors", 0);
+#else
+  Host_Check(stats->PagePrograms != programs, "in place page programs", 0);
+  Host_Check(LoaderStats.BitClearedSectors - before.BitClearedSectors == SECTORS_COUNT, "BitClearedSectors", 0);
+#endif
+#endif
+
+  /* An erase only session: the range reads blank once SectorErase
+     returns, with no other call to complete it */
+  address = 8 * MEMORY_SECTOR_SIZE;
+  Host_Check(Init() == LOADER_OK, "Init", 8);
+  Host_Check(SectorErase(address, address + 3 * MEMORY_SECTOR_SIZE - 1) == LOADER_OK, "SectorErase", 8);
+  for (j = 0; j < 3 * MEMORY_SECTOR_SIZE; j++)
+  {
+    Host_Check(memory[address + j] == MEMORY_ERASE_VALUE, "erase only session", 8 + j / MEMORY_SECTOR_SIZE);
+  }
+
+#if LOADER_WRITE_ERASE
+  /* Two halves of a sector then the first one again, without SectorErase
+     on a sector holding stale data, then after a SectorErase: each write
+     keeps what the others programmed */
+  address = 6 * MEMORY_SECTOR_SIZE;
+  for (i = 0; i < 2; i++)
+  {
+    Host_Check(Init() == LOADER_OK, "Init", 6);
+    memset(&memory[address], 0x5A, MEMORY_SECTOR_SIZE);
+    memset(wData, 0x5A, MEMORY_SECTOR_SIZE);
+    if (i != 0)
+    {
+      Host_Check(SectorErase(address, address) == LOADER_OK, "SectorErase", 6);
+      memset(wData, MEMORY_ERASE_VALUE, MEMORY_SECTOR_SIZE);
+    }
+    
+    for (j = 0; j < 3 * MEMORY_SECTOR_SIZE / 2; j++)
+    {
+      wData[j % MEMORY_SECTOR_SIZE] = (uint8_t)(i * 13 + j + (j >> 8));
+      if ((j + 1) % (MEMORY_SECTOR_SIZE / 2) != 0)
+        continue;
+      sum = (j + 1 - MEMORY_SECTOR_SIZE / 2) % MEMORY_SECTOR_SIZE;
+      Host_Check(Write(address + sum, MEMORY_SECTOR_SIZE / 2, &wData[sum]) == LOADER_OK, "Write half sector", 6);
+      Host_Check(memcmp(&memory[address], wData, MEMORY_SECTOR_SIZE) == 0, "half sector content", 6);
+    }
+  }
+#endif
+
+  /* A chip that never leaves BUSY fails Init within the longest erase
+     time instead of stalling the programmer */
+  HalHost_MisoStuckHigh = 1;
+  start = W25Q80_Sim_Now();
+  Host_Check(Init() == LOADER_FAIL, "Init with MISO stuck high", 0);
+  Host_Check(W25Q80_Sim_Now() - start < 2ULL * W25Q80_SECTOR_ERASE_MAX_TIME * 1000000ULL, "Init timeout", 0);
+  HalHost_MisoStuckHigh = 0;
+  Host_Check(Init() == LOADER_OK, "Init after MISO release", 0);
+
+#if W25Qx_DIRECT_SPI
+  /* A stalled SPI3 fails the register layer transfers after their poll
+     limit */
+  HalHost_SpiStalled = 1;
+  start = W25Q80_Sim_Now();
+  Host_Check(Init() == LOADER_FAIL, "Init with SPI3 stalled", 0);
+  Host_Check(W25Q80_Sim_Now() - start < 10000000ULL, "SPI3 poll limit", 0);
+  HalHost_SpiStalled = 0;
+  Host_Check(Init() == LOADER_OK, "Init after SPI3 release", 0);
+#endif
+
+  /* Every command the driver sent was complete and accepted */
+  Host_Check(stats->IgnoredCommands == 0, "ignored commands", 0);
+
+  printf("host loader run passed\n");
+  printf("  virtual time     %llu ms\n", (unsigned long long)(W25Q80_Sim_Now() / 1000000ULL));
+  printf("  transactions     %llu\n", (unsigned long long)stats->Transactions);
+  printf("  bytes on wire    %llu\n", (unsigned long long)stats->BytesOnWire);
+  printf("  busy polls       %llu\n", (unsigned long long)stats->BusyPolls);
+  printf("  page programs    %lu\n", (unsigned long)stats->PagePrograms);
+  printf("  sector erases    %lu\n", (unsigned long)stats->SectorErases);
+  printf("  chip erases      %lu\n", (unsigned long)stats->ChipErases);
+  printf("  ignored commands %lu\n", (unsigned long)stats->IgnoredCommands);
+  return 0;
+}
@@ -0,0 +1,254 @@
+/**
+  ******************************************************************************
+  * @file    w25qx_trace.c
+  * @brief   Decoder of a W25Qx_Trace dump (W25Qx_TRACE of W25QXX.h): the
+  *          raw bytes of the W25Qx_Trace symbol, read over SWD or written
+  *          by loader_bench -t. Prints the chip select cycles oldest first
+  *          with their start time, duration and the gap since the previous
+  *          cycle (CPU, HAL and host time), then the latency histogram of
+  *          each command.
+  *
+  *          w25qx_trace [-s] [-f clock_hz] dump.bin
+  *            -s         histograms only
+  *            -f         DWT clock when the dump does not hold a valid one
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "W25QXX.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_HEADER_WORDS   4
+#define TRACE_RECORD_WORDS   4
+#define TRACE_BUCKETS        24     /* powers of 2 of us, up to 8s */
+#define TRACE_BAR_WIDTH      40
+
+/* Durations of one command */
+typedef struct
+{
+  uint32_t Count;
+  uint32_t Errors;
+  uint64_t Total;
+  uint32_t Min;
+  uint32_t Max;
+  uint32_t Buckets[TRACE_BUCKETS];
+} Trace_StatsTypeDef;
+
+/* Gaps between cycles are accounted under this pseudo opcode */
+#define TRACE_GAP            0x100
+
+static Trace_StatsTypeDef TraceStats[0x101];
+static double TraceClock;
+
+static uint32_t Trace_Word(const uint8_t* Data)
+{
+  /* The dump is little endian, as the Cortex-M4 */
+  return (uint32_t)Data[0] | ((uint32_t)Data[1] << 8) | ((uint32_t)Data[2] << 16) | ((uint32_t)Data[3] << 24);
+}
+
+static const char* Trace_Name(uint32_t Opcode)
+{
+  switch (Opcode)
+  {
+    case RESET_ENABLE_CMD:      return "reset";
+    case READ_ID_CMD:           return "read id";
+    case READ_JEDEC_ID_CMD:     return "jedec id";
+    case READ_CMD:              return "read";
+    case FAST_READ_CMD:         return "fast read";
+    case WRITE_ENABLE_CMD:      return "write enable";
+    case WRITE_DISABLE_CMD:     return "write disable";
+    case READ_STATUS_REG1_CMD:  return "status";
+    case PAGE_PROG_CMD:         return "page program";
+    case SECTOR_ERASE_CMD:      return "sector erase";
+    case BLOCK32_ERASE_CMD:     return "block32 erase";
+    case BLOCK64_ERASE_CMD:     return "block64 erase";
+    case CHIP_ERASE_CMD:        return "chip erase";
+    case TRACE_GAP:             return "(gap)";
+    default:                    return "?";
+  }
+}
+
+static const char* Trace_Result(uint32_t Result)
+{
+  switch (Result)
+  {
+    case W25Qx_OK:      return "ok";
+    case W25Qx_ERROR:   return "error";
+    case W25Qx_BUSY:    return "busy";
+    case W25Qx_TIMEOUT: return "timeout";
+    default:            return "?";
+  }
+}
+
+static double Trace_Us(uint64_t Cycles)
+{
+  return Cycles * 1e6 / TraceClock;
+}
+
+static void Trace_Account(uint32_t Opcode, uint32_t Cycles, int Failed)
+{
+  Trace_StatsTypeDef* stats = &TraceStats[Opcode];
+  uint64_t us = (uint64_t)Trace_Us(Cycles);
+  int bucket = 0;
+
+  while (bucket < TRACE_BUCKETS - 1 && us >= (1ULL << bucket))
+    bucket++;
+
+  if (stats->Count == 0 || Cycles < stats->Min)
+    stats->Min = Cycles;
+  if (Cycles > stats->Max)
+    stats->Max = Cycles;
+  stats->Count++;
+  stats->Errors += Failed;
+  stats->Total += Cycles;
+  stats->Buckets[bucket]++;
+}
+
+static void Trace_PrintHistogram(const Trace_StatsTypeDef* Stats, uint32_t Opcode)
+{
+  uint32_t peak = 0;
+  int i, width;
+
+  printf("\n%s: %lu cycles, %lu failed, min %.2f us, avg %.2f us, max %.2f us, total %.1f us\n",
+         Trace_Name(Opcode), (unsigned long)Stats->Count, (unsigned long)Stats->Errors,
+         Trace_Us(Stats->Min), Trace_Us(Stats->Total) / Stats->Count, Trace_Us(Stats->Max),
+         Trace_Us(Stats->Total));
+
+  for (i = 0; i < TRACE_BUCKETS; i++)
+  {
+    if (Stats->Buckets[i] > peak)
+      peak = Stats->Buckets[i];
+  }
+
+  for (i = 0; i < TRACE_BUCKETS; i++)
+  {
+    if (Stats->Buckets[i] == 0)
+      continue;
+    width = (int)((Stats->Buckets[i] * (uint64_t)TRACE_BAR_WIDTH + peak - 1) / peak);
+    if (i == 0)
+      printf("  %10s < %-9lu us %8lu ", "", 1UL, (unsigned long)Stats->Buckets[i]);
+    else
+      printf("  %10lu - %-9lu us %8lu ", 1UL << (i - 1), 1UL << i, (unsigned long)Stats->Buckets[i]);
+    while (width-- > 0)
+      putchar('#');
+    putchar('\n');
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  const char* path = NULL;
+  uint8_t* dump;
+  const uint8_t* record;
+  FILE* file;
+  long size;
+  uint32_t depth, count, records, first, i, opcode, address, length, result, start, end, previous_end = 0;
+  uint64_t time = 0;
+  int summary = 0, a;
+
+  for (a = 1; a < argc; a++)
+  {
+    if (strcmp(argv[a], "-s") == 0)
+      summary = 1;
+    else if (strcmp(argv[a], "-f") == 0 && a + 1 < argc)
+      TraceClock = atof(argv[++a]);
+    else if (path == NULL && argv[a][0] != '-')
+      path = argv[a];
+    else
+    {
+      path = NULL;
+      break;
+    }
+  }
+  if (path == NULL)
+  {
+    fprintf(stderr, "usage: %s [-s] [-f clock_hz] dump.bin\n", argv[0]);
+    return 2;
+  }
+
+  file = fopen(path, "rb");
+  if (file == NULL || fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 4 * TRACE_HEADER_WORDS)
+  {
+    fprintf(stderr, "%s: cannot read the trace header\n", path);
+    return 1;
+  }
+  rewind(file);
+  dump = malloc(size);
+  if (dump == NULL || fread(dump, 1, size, file) != (size_t)size)
+  {
+    fprintf(stderr, "%s: read error\n", path);
+    return 1;
+  }
+  fclose(file);
+
+  if (Trace_Word(dump) != W25Qx_TRACE_MAGIC)
+  {
+    fprintf(stderr, "%s: not a W25Qx_Trace dump\n", path);
+    return 1;
+  }
+  depth = Trace_Word(dump + 4);
+  if (depth == 0 || (depth & (depth - 1)) != 0 ||
+      (uint64_t)size < 4ULL * (TRACE_HEADER_WORDS + (uint64_t)depth * TRACE_RECORD_WORDS))
+  {
+    fprintf(stderr, "%s: truncated dump, %lu records expected\n", path, (unsigned long)depth);
+    return 1;
+  }
+  if (TraceClock == 0)
+    TraceClock = Trace_Word(dump + 8);
+  if (TraceClock == 0)
+  {
+    fprintf(stderr, "%s: no DWT clock in the dump, give it with -f\n", path);
+    return 1;
+  }
+  count = Trace_Word(dump + 12);
+
+  /* Oldest record first once the ring has wrapped */
+  records = (count < depth) ? count : depth;
+  first = count - records;
+  printf("%lu chip select cycles traced, %lu kept, DWT clock %.0f Hz\n",
+         (unsigned long)count, (unsigned long)records, TraceClock);
+
+  if (!summary)
+    printf("\n%8s %14s %10s %10s  %-14s %8s %8s %s\n",
+           "index", "start_us", "dur_us", "gap_us", "command", "address", "length", "result");
+
+  for (i = 0; i < records; i++)
+  {
+    record = dump + 4 * (TRACE_HEADER_WORDS + ((first + i) & (depth - 1)) * TRACE_RECORD_WORDS);
+    start = Trace_Word(record);
+    end = Trace_Word(record + 4);
+    opcode = Trace_Word(record + 8) >> 24;
+    address = Trace_Word(record + 8) & 0x00FFFFFF;
+    length = Trace_Word(record + 12) & 0x00FFFFFF;
+    result = Trace_Word(record + 12) >> 24;
+
+    /* Stamps wrap, the differences do not as long as cycles and gaps
+       stay under 2^32 cycles */
+    if (i != 0)
+    {
+      time += (uint32_t)(start - previous_end);
+      Trace_Account(TRACE_GAP, start - previous_end, 0);
+    }
+    Trace_Account(opcode, end - start, result != W25Qx_OK);
+
+    if (!summary)
+      printf("%8lu %14.2f %10.2f %10.2f  %-14s %8.6lx %8lu %s\n",
+             (unsigned long)(first + i), Trace_Us(time), Trace_Us(end - start),
+             (i != 0) ? Trace_Us(start - previous_end) : 0.0, Trace_Name(opcode),
+             (unsigned long)address, (unsigned long)length, Trace_Result(result));
+
+    time += (uint32_t)(end - start);
+    previous_end = end;
+  }
+
+  for (opcode = 0; opcode <= TRACE_GAP; opcode++)
+  {
+    if (TraceStats[opcode].Count != 0)
+      Trace_PrintHistogram(&TraceStats[opcode], opcode);
+  }
+
+  free(dump);
+  return 0;
+}